@@ -65,6 +65,16 @@
 #endif
 
 
+#ifndef NGX_HAVE_SET_MEMPOLICY
+#define NGX_HAVE_SET_MEMPOLICY  1
+#endif
+
+
+#ifndef NGX_HAVE_MADV_HUGEPAGE
+#define NGX_HAVE_MADV_HUGEPAGE  1
+#endif
+
+
 #ifndef NGX_HAVE_GNU_CRYPT_R
 #define NGX_HAVE_GNU_CRYPT_R  1
 #endif
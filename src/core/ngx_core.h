@@ -62,7 +62,9 @@ typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
 #include <ngx_queue.h>
 #include <ngx_array.h>
 #include <ngx_list.h>
+#include <ngx_freelist.h>
 #include <ngx_hash.h>
+#include <ngx_hash_file.h>
 #include <ngx_file.h>
 #include <ngx_crc.h>
 #include <ngx_crc32.h>
@@ -100,8 +102,12 @@ typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
 #define ngx_max(val1, val2)  ((val1 < val2) ? (val2) : (val1))
 #define ngx_min(val1, val2)  ((val1 > val2) ? (val2) : (val1))
 
+#define NGX_CPU_SSE2         0x01
+
 void ngx_cpuinfo(void);
 
+extern ngx_uint_t  ngx_cpu_features;
+
 #if (NGX_HAVE_OPENAT)
 #define NGX_DISABLE_SYMLINKS_OFF        0
 #define NGX_DISABLE_SYMLINKS_ON         1
@@ -0,0 +1,83 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+ngx_freelist_t *
+ngx_freelist_create(ngx_pool_t *pool, size_t size, char *name)
+{
+    ngx_freelist_t  *fl;
+
+    fl = ngx_palloc(pool, sizeof(ngx_freelist_t));
+    if (fl == NULL) {
+        return NULL;
+    }
+
+    ngx_freelist_init(fl, pool, size, name);
+
+    return fl;
+}
+
+
+ngx_int_t
+ngx_freelist_preallocate(ngx_freelist_t *fl, ngx_uint_t n)
+{
+    u_char              *p;
+    ngx_freelist_obj_t  *obj;
+
+    if (n > NGX_MAX_SIZE_T_VALUE / fl->size) {
+        ngx_log_error(NGX_LOG_ALERT, fl->pool->log, 0,
+                      "too many %s objects to preallocate: %ui", fl->name, n);
+        return NGX_ERROR;
+    }
+
+    /* the objects are allocated at once, so they share the pool blocks */
+
+    p = ngx_palloc(fl->pool, n * fl->size);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    fl->nalloc += n;
+
+    while (n--) {
+        obj = (ngx_freelist_obj_t *) p;
+        p += fl->size;
+
+        ngx_freelist_free(fl, obj);
+    }
+
+    return NGX_OK;
+}
+
+
+void *
+ngx_freelist_calloc(ngx_freelist_t *fl)
+{
+    void  *p;
+
+    p = ngx_freelist_alloc(fl);
+
+    if (p) {
+        ngx_memzero(p, fl->size);
+    }
+
+    return p;
+}
+
+
+void
+ngx_freelist_stat_log(ngx_freelist_t *fl, ngx_uint_t level, ngx_log_t *log)
+{
+    ngx_log_error(level, log, 0,
+                  "freelist \"%s\" size:%uz allocated:%ui free:%ui "
+                  "allocs:%ui reused:%ui",
+                  fl->name, fl->size, fl->nalloc, fl->nfree,
+                  fl->allocs, fl->reuses);
+}
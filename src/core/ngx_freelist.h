@@ -0,0 +1,106 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_FREELIST_H_INCLUDED_
+#define _NGX_FREELIST_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/*
+ * a free list of objects of the same size allocated from a pool:
+ * the freed objects are kept in the list and reused by the next
+ * allocations instead of being left in the pool until it is destroyed
+ */
+
+typedef struct ngx_freelist_obj_s  ngx_freelist_obj_t;
+
+struct ngx_freelist_obj_s {
+    ngx_freelist_obj_t  *next;
+};
+
+
+typedef struct {
+    ngx_freelist_obj_t  *free;
+    size_t               size;
+    ngx_pool_t          *pool;
+    char                *name;
+
+    ngx_uint_t           nalloc;     /* objects allocated from the pool */
+    ngx_uint_t           nfree;      /* objects in the list */
+    ngx_uint_t           allocs;
+    ngx_uint_t           reuses;
+} ngx_freelist_t;
+
+
+ngx_freelist_t *ngx_freelist_create(ngx_pool_t *pool, size_t size, char *name);
+ngx_int_t ngx_freelist_preallocate(ngx_freelist_t *fl, ngx_uint_t n);
+void *ngx_freelist_calloc(ngx_freelist_t *fl);
+void ngx_freelist_stat_log(ngx_freelist_t *fl, ngx_uint_t level,
+    ngx_log_t *log);
+
+
+static ngx_inline void
+ngx_freelist_init(ngx_freelist_t *fl, ngx_pool_t *pool, size_t size,
+    char *name)
+{
+    fl->free = NULL;
+    fl->size = ngx_align(ngx_max(size, sizeof(ngx_freelist_obj_t)),
+                         NGX_ALIGNMENT);
+    fl->pool = pool;
+    fl->name = name;
+
+    fl->nalloc = 0;
+    fl->nfree = 0;
+    fl->allocs = 0;
+    fl->reuses = 0;
+}
+
+
+static ngx_inline void *
+ngx_freelist_alloc(ngx_freelist_t *fl)
+{
+    ngx_freelist_obj_t  *obj;
+
+    fl->allocs++;
+
+    obj = fl->free;
+
+    if (obj) {
+        fl->free = obj->next;
+        fl->nfree--;
+        fl->reuses++;
+
+        return obj;
+    }
+
+    obj = ngx_palloc(fl->pool, fl->size);
+
+    if (obj) {
+        fl->nalloc++;
+    }
+
+    return obj;
+}
+
+
+static ngx_inline void
+ngx_freelist_free(ngx_freelist_t *fl, void *p)
+{
+    ngx_freelist_obj_t  *obj;
+
+    obj = p;
+
+    obj->next = fl->free;
+    fl->free = obj;
+    fl->nfree++;
+}
+
+
+#endif /* _NGX_FREELIST_H_INCLUDED_ */
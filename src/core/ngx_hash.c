@@ -9,6 +9,88 @@
 #include <ngx_core.h>
 
 
+/* the number of hash sizes tested one by one before the step is grown */
+#define NGX_HASH_SCAN_SIZES     64
+
+/*
+ * a perfect hash has a displacement per NGX_HASH_PERFECT_KEYS keys
+ * on average, and a slot per key plus a quarter
+ */
+#define NGX_HASH_PERFECT_KEYS   4
+#define NGX_HASH_PERFECT_TRIES  65536
+
+/*
+ * a bucket starts with an array of NGX_HASH_TAGS one-byte tags of its
+ * elements, the tags are made of the key bits not used for the bucket
+ * number and of the length, and are compared all at once
+ */
+#define NGX_HASH_TAGS           16
+
+#define ngx_hash_tag(key, len)                                                \
+    (u_char) (((((key) >> 16) ^ ((key) >> 24) ^ (len)) & 0x7f) | 0x80)
+
+
+/*
+ * the word-at-a-time hash functions, the bytes of the word are
+ * lowercased at once, see ngx_hash_word_lc()
+ */
+
+#if (NGX_PTR_SIZE == 4)
+#define NGX_HASH_MUL            0x9e3779b1
+#define NGX_HASH_SHIFT          15
+#else
+#define NGX_HASH_MUL            0x9e3779b97f4a7c15
+#define NGX_HASH_SHIFT          29
+#endif
+
+#define NGX_HASH_BYTES          ((ngx_uint_t) ~0 / 0xff)
+
+/*
+ * the indexes of the keys in ngx_hash_keys_arrays_t, which are used
+ * to find the duplicates, grow by NGX_HASH_KEYS_GROW times once there
+ * are NGX_HASH_KEYS_LOAD keys per bucket on average
+ */
+#define NGX_HASH_KEYS_LOAD      4
+#define NGX_HASH_KEYS_GROW      4
+
+
+#if (( __i386__ || __amd64__ ) && ( __GNUC__ >= 5 || __clang__ ))
+
+#include <emmintrin.h>
+
+#define NGX_HASH_SSE2           1
+
+static ngx_uint_t ngx_hash_match_sse2(u_char *tags, u_char tag)
+    __attribute__ ((target ("sse2")));
+
+#endif
+
+
+static ngx_inline ngx_uint_t ngx_hash_perfect_slot(ngx_uint_t key,
+    ngx_uint_t disp, ngx_uint_t size);
+static void *ngx_hash_find_perfect(ngx_hash_t *hash, ngx_uint_t key,
+    u_char *name, size_t len);
+static void *ngx_hash_find_tagged(ngx_hash_elt_t *elt, ngx_uint_t key,
+    u_char *name, size_t len);
+static ngx_uint_t ngx_hash_match(u_char *tags, u_char tag);
+
+
+static ngx_uint_t (*ngx_hash_match_tags)(u_char *tags, u_char tag)
+    = ngx_hash_match;
+static void ngx_hash_rekey(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
+    ngx_uint_t nelts, ngx_uint_t *hashes);
+static ngx_inline ngx_uint_t ngx_hash_mix(ngx_uint_t key, ngx_uint_t w);
+static ngx_inline ngx_uint_t ngx_hash_word_lc(ngx_uint_t w);
+static ngx_int_t ngx_hash_test_size(ngx_hash_init_t *hinit,
+    ngx_hash_key_t *names, ngx_uint_t nelts, ngx_uint_t *hashes,
+    u_short *test, ngx_uint_t size, ngx_uint_t bucket_size);
+static ngx_int_t ngx_hash_keys_grow(ngx_hash_keys_arrays_t *ha, ngx_uint_t n);
+static ngx_int_t ngx_hash_keys_rehash(ngx_hash_keys_arrays_t *ha,
+    ngx_array_t **index, ngx_uint_t hsize, size_t trim);
+static int ngx_libc_cdecl ngx_hash_keys_cmp(const void *one,
+    const void *two);
+
+
 void *
 ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
 {
@@ -19,12 +101,20 @@ ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
     ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "hf:\"%*s\"", len, name);
 #endif
 
+    if (hash->disp) {
+        return ngx_hash_find_perfect(hash, key, name, len);
+    }
+
     elt = hash->buckets[key % hash->size];
 
     if (elt == NULL) {
         return NULL;
     }
 
+    if (hash->tags) {
+        return ngx_hash_find_tagged(elt, key, name, len);
+    }
+
     while (elt->value) {
         if (len != (size_t) elt->len) {
             goto next;
@@ -49,6 +139,107 @@ ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
 }
 
 
+static void *
+ngx_hash_find_tagged(ngx_hash_elt_t *elt, ngx_uint_t key, u_char *name,
+    size_t len)
+{
+    ngx_uint_t  mask;
+
+    /* the bits of the mask are set for the elements with the same tag */
+
+    mask = ngx_hash_match_tags((u_char *) elt - NGX_HASH_TAGS,
+                               ngx_hash_tag(key, len));
+
+    while (mask) {
+
+        if ((mask & 1)
+            && len == (size_t) elt->len
+            && ngx_memcmp(name, elt->name, len) == 0)
+        {
+            return elt->value;
+        }
+
+        mask >>= 1;
+
+        elt = (ngx_hash_elt_t *) ngx_align_ptr(&elt->name[0] + elt->len,
+                                               sizeof(void *));
+    }
+
+    return NULL;
+}
+
+
+static ngx_uint_t
+ngx_hash_match(u_char *tags, u_char tag)
+{
+    ngx_uint_t  i, mask;
+
+    mask = 0;
+
+    for (i = 0; i < NGX_HASH_TAGS; i++) {
+        if (tags[i] == tag) {
+            mask |= (ngx_uint_t) 1 << i;
+        }
+    }
+
+    return mask;
+}
+
+
+#if (NGX_HASH_SSE2)
+
+static ngx_uint_t
+ngx_hash_match_sse2(u_char *tags, u_char tag)
+{
+    __m128i  v;
+
+    v = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *) tags),
+                       _mm_set1_epi8((char) tag));
+
+    return (ngx_uint_t) _mm_movemask_epi8(v);
+}
+
+#endif
+
+
+static ngx_inline ngx_uint_t
+ngx_hash_perfect_slot(ngx_uint_t key, ngx_uint_t disp, ngx_uint_t size)
+{
+    key ^= disp * 0x9e3779b9;
+
+    key ^= key >> 16;
+    key *= 0x85ebca6b;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35;
+    key ^= key >> 16;
+
+    return key % size;
+}
+
+
+static void *
+ngx_hash_find_perfect(ngx_hash_t *hash, ngx_uint_t key, u_char *name,
+    size_t len)
+{
+    ngx_uint_t       n;
+    ngx_hash_elt_t  *elt;
+
+    n = ngx_hash_perfect_slot(key, hash->disp[key % hash->ndisp], hash->size);
+
+    elt = hash->buckets[n];
+
+    if (elt == NULL || len != (size_t) elt->len) {
+        return NULL;
+    }
+
+    if (ngx_memcmp(name, elt->name, len) != 0) {
+        return NULL;
+    }
+
+    return elt->value;
+}
+
+
 void *
 ngx_hash_find_wc_head(ngx_hash_wildcard_t *hwc, u_char *name, size_t len)
 {
@@ -251,10 +442,11 @@ ngx_hash_find_combined(ngx_hash_combined_t *hash, ngx_uint_t key, u_char *name,
 ngx_int_t
 ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
 {
-    u_char          *elts;
+    u_char          *elts, *tags;
     size_t           len;
     u_short         *test;
-    ngx_uint_t       i, n, key, size, start, bucket_size;
+    ngx_uint_t       i, n, key, size, start, last, mid, step, bucket_size,
+                     tagged, *hashes;
     ngx_hash_elt_t  *elt, **buckets;
 
     if (hinit->max_size == 0) {
@@ -265,8 +457,22 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
         return NGX_ERROR;
     }
 
+    /*
+     * a bucket holds the tags, the elements, and the NULL value
+     * that ends them, so even an empty key needs three pointers
+     */
+
+    if (hinit->bucket_size < NGX_HASH_TAGS + 3 * sizeof(void *)) {
+        ngx_log_error(NGX_LOG_EMERG, hinit->pool->log, 0,
+                      "could not build %s, you should "
+                      "increase %s_bucket_size: %i",
+                      hinit->name, hinit->name, hinit->bucket_size);
+        return NGX_ERROR;
+    }
+
     for (n = 0; n < nelts; n++) {
-        if (hinit->bucket_size < NGX_HASH_ELT_SIZE(&names[n]) + sizeof(void *))
+        if (hinit->bucket_size
+            < NGX_HASH_TAGS + NGX_HASH_ELT_SIZE(&names[n]) + sizeof(void *))
         {
             ngx_log_error(NGX_LOG_EMERG, hinit->pool->log, 0,
                           "could not build %s, you should "
@@ -276,12 +482,17 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
         }
     }
 
-    test = ngx_alloc(hinit->max_size * sizeof(u_short), hinit->pool->log);
-    if (test == NULL) {
+    hashes = ngx_alloc(nelts * sizeof(ngx_uint_t)
+                       + hinit->max_size * sizeof(u_short), hinit->pool->log);
+    if (hashes == NULL) {
         return NGX_ERROR;
     }
 
-    bucket_size = hinit->bucket_size - sizeof(void *);
+    test = (u_short *) (hashes + nelts);
+
+    ngx_hash_rekey(hinit, names, nelts, hashes);
+
+    bucket_size = hinit->bucket_size - NGX_HASH_TAGS - sizeof(void *);
 
     start = nelts / (bucket_size / (2 * sizeof(void *)));
     start = start ? start : 1;
@@ -290,34 +501,56 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
         start = hinit->max_size - 1000;
     }
 
-    for (size = start; size <= hinit->max_size; size++) {
+    /*
+     * the sizes after the start are tested one by one, as a small hash
+     * usually fits soon; then each test of a size rehashes all the keys,
+     * so for large sets of keys the size grows by an eighth until
+     * it fits, and the size found is reduced by the binary search
+     * between it and the last size that does not fit; the larger sizes
+     * mostly fit, so the size found is close to the smallest one
+     */
+
+    for (size = start;
+         size <= hinit->max_size && size - start < NGX_HASH_SCAN_SIZES;
+         size++)
+    {
+        if (ngx_hash_test_size(hinit, names, nelts, hashes, test, size,
+                               bucket_size)
+            == NGX_OK)
+        {
+            goto found;
+        }
+    }
 
-        ngx_memzero(test, size * sizeof(u_short));
+    last = size - 1;
 
-        for (n = 0; n < nelts; n++) {
-            if (names[n].key.data == NULL) {
-                continue;
-            }
+    while (last < hinit->max_size) {
 
-            key = names[n].key_hash % size;
-            test[key] = (u_short) (test[key] + NGX_HASH_ELT_SIZE(&names[n]));
+        step = ngx_max(last / 8, NGX_HASH_SCAN_SIZES);
+        size = ngx_min(last + step, hinit->max_size);
 
-#if 0
-            ngx_log_error(NGX_LOG_ALERT, hinit->pool->log, 0,
-                          "%ui: %ui %ui \"%V\"",
-                          size, key, test[key], &names[n].key);
-#endif
+        if (ngx_hash_test_size(hinit, names, nelts, hashes, test, size,
+                               bucket_size)
+            == NGX_OK)
+        {
+            while (size - last > 1) {
+                mid = last + (size - last) / 2;
 
-            if (test[key] > (u_short) bucket_size) {
-                goto next;
-            }
-        }
+                if (ngx_hash_test_size(hinit, names, nelts, hashes, test,
+                                       mid, bucket_size)
+                    == NGX_OK)
+                {
+                    size = mid;
 
-        goto found;
+                } else {
+                    last = mid;
+                }
+            }
 
-    next:
+            goto found;
+        }
 
-        continue;
+        last = size;
     }
 
     size = hinit->max_size;
@@ -340,7 +573,7 @@ found:
             continue;
         }
 
-        key = names[n].key_hash % size;
+        key = hashes[n] % size;
         test[key] = (u_short) (test[key] + NGX_HASH_ELT_SIZE(&names[n]));
     }
 
@@ -351,7 +584,8 @@ found:
             continue;
         }
 
-        test[i] = (u_short) (ngx_align(test[i], ngx_cacheline_size));
+        test[i] = (u_short) (ngx_align(test[i] + NGX_HASH_TAGS,
+                                       ngx_cacheline_size));
 
         len += test[i];
     }
@@ -360,7 +594,7 @@ found:
         hinit->hash = ngx_pcalloc(hinit->pool, sizeof(ngx_hash_wildcard_t)
                                              + size * sizeof(ngx_hash_elt_t *));
         if (hinit->hash == NULL) {
-            ngx_free(test);
+            ngx_free(hashes);
             return NGX_ERROR;
         }
 
@@ -370,14 +604,14 @@ found:
     } else {
         buckets = ngx_pcalloc(hinit->pool, size * sizeof(ngx_hash_elt_t *));
         if (buckets == NULL) {
-            ngx_free(test);
+            ngx_free(hashes);
             return NGX_ERROR;
         }
     }
 
     elts = ngx_palloc(hinit->pool, len + ngx_cacheline_size);
     if (elts == NULL) {
-        ngx_free(test);
+        ngx_free(hashes);
         return NGX_ERROR;
     }
 
@@ -388,7 +622,9 @@ found:
             continue;
         }
 
-        buckets[i] = (ngx_hash_elt_t *) elts;
+        ngx_memzero(elts, NGX_HASH_TAGS);
+
+        buckets[i] = (ngx_hash_elt_t *) (elts + NGX_HASH_TAGS);
         elts += test[i];
     }
 
@@ -396,12 +632,14 @@ found:
         test[i] = 0;
     }
 
+    tagged = 1;
+
     for (n = 0; n < nelts; n++) {
         if (names[n].key.data == NULL) {
             continue;
         }
 
-        key = names[n].key_hash % size;
+        key = hashes[n] % size;
         elt = (ngx_hash_elt_t *) ((u_char *) buckets[key] + test[key]);
 
         elt->value = names[n].value;
@@ -410,6 +648,19 @@ found:
         ngx_strlow(elt->name, names[n].key.data, names[n].key.len);
 
         test[key] = (u_short) (test[key] + NGX_HASH_ELT_SIZE(&names[n]));
+
+        /* a bucket with more elements than tags is not tagged */
+
+        tags = (u_char *) buckets[key] - NGX_HASH_TAGS;
+
+        for (i = 0; i < NGX_HASH_TAGS && tags[i]; i++) { /* void */ }
+
+        if (i == NGX_HASH_TAGS) {
+            tagged = 0;
+            continue;
+        }
+
+        tags[i] = ngx_hash_tag(hashes[n], names[n].key.len);
     }
 
     for (i = 0; i < size; i++) {
@@ -422,10 +673,19 @@ found:
         elt->value = NULL;
     }
 
-    ngx_free(test);
+    ngx_free(hashes);
 
     hinit->hash->buckets = buckets;
     hinit->hash->size = size;
+    hinit->hash->tags = tagged;
+    hinit->hash->disp = NULL;
+    hinit->hash->ndisp = 0;
+
+#if (NGX_HASH_SSE2)
+    if (ngx_cpu_features & NGX_CPU_SSE2) {
+        ngx_hash_match_tags = ngx_hash_match_sse2;
+    }
+#endif
 
 #if 0
 
@@ -461,6 +721,266 @@ found:
 }
 
 
+/*
+ * a perfect hash is built with the CHD algorithm: the keys are grouped
+ * by key_hash % ndisp, and starting from the largest group, a displacement
+ * is searched for each group, so that all its keys get free slots;
+ * a lookup is one probe of a slot plus one comparison of the key.
+ * If a perfect hash cannot be built, e.g. if the keys have the same
+ * key_hash, a usual hash is built by ngx_hash_init()
+ */
+
+ngx_int_t
+ngx_hash_perfect_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
+    ngx_uint_t nelts)
+{
+    u_char          *taken, *elts;
+    size_t           len;
+    u_short         *disp, *d16;
+    ngx_uint_t       i, n, k, b, d, m, size, ndisp, max, *count, *start,
+                    *keys, *slots, *hashes;
+    ngx_hash_elt_t  *elt, **buckets;
+
+    m = 0;
+    len = 0;
+
+    for (n = 0; n < nelts; n++) {
+        if (names[n].key.data == NULL) {
+            continue;
+        }
+
+        m++;
+        len += NGX_HASH_ELT_SIZE(&names[n]);
+    }
+
+    if (m == 0) {
+        return ngx_hash_init(hinit, names, nelts);
+    }
+
+    ndisp = (m + NGX_HASH_PERFECT_KEYS - 1) / NGX_HASH_PERFECT_KEYS;
+    size = m + m / 4 + 1;
+
+    /*
+     * the temporary arrays: hashes, count, start, keys, slots,
+     * displacements
+     */
+
+    hashes = ngx_alloc((nelts + 2 * ndisp + 2 * m) * sizeof(ngx_uint_t)
+                       + ndisp * sizeof(u_short) + size, hinit->pool->log);
+    if (hashes == NULL) {
+        return NGX_ERROR;
+    }
+
+    count = hashes + nelts;
+    start = count + ndisp;
+    keys = start + ndisp;
+    slots = keys + m;
+    d16 = (u_short *) (slots + m);
+    taken = (u_char *) (d16 + ndisp);
+
+    ngx_hash_rekey(hinit, names, nelts, hashes);
+
+    ngx_memzero(count, ndisp * sizeof(ngx_uint_t));
+    ngx_memzero(taken, size);
+
+    for (n = 0; n < nelts; n++) {
+        if (names[n].key.data != NULL) {
+            count[hashes[n] % ndisp]++;
+        }
+    }
+
+    max = 0;
+    k = 0;
+
+    for (b = 0; b < ndisp; b++) {
+        start[b] = k;
+        k += count[b];
+
+        if (count[b] > max) {
+            max = count[b];
+        }
+
+        count[b] = 0;
+    }
+
+    for (n = 0; n < nelts; n++) {
+        if (names[n].key.data != NULL) {
+            b = hashes[n] % ndisp;
+            keys[start[b] + count[b]++] = n;
+        }
+    }
+
+    for ( /* void */ ; max; max--) {
+
+        for (b = 0; b < ndisp; b++) {
+            if (count[b] != max) {
+                continue;
+            }
+
+            for (d = 0; d < NGX_HASH_PERFECT_TRIES; d++) {
+
+                for (i = 0; i < max; i++) {
+                    n = keys[start[b] + i];
+                    slots[i] = ngx_hash_perfect_slot(hashes[n], d, size);
+
+                    if (taken[slots[i]]) {
+                        goto next;
+                    }
+
+                    taken[slots[i]] = 1;
+                }
+
+                d16[b] = (u_short) d;
+
+                goto done;
+
+            next:
+
+                while (i--) {
+                    taken[slots[i]] = 0;
+                }
+            }
+
+            ngx_log_debug1(NGX_LOG_DEBUG_CORE, hinit->pool->log, 0,
+                           "could not build perfect %s", hinit->name);
+
+            ngx_free(hashes);
+
+            return ngx_hash_init(hinit, names, nelts);
+
+        done:
+
+            continue;
+        }
+    }
+
+    disp = ngx_palloc(hinit->pool, ndisp * sizeof(u_short));
+    if (disp == NULL) {
+        ngx_free(hashes);
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(disp, d16, ndisp * sizeof(u_short));
+
+    if (hinit->hash == NULL) {
+        hinit->hash = ngx_pcalloc(hinit->pool, sizeof(ngx_hash_wildcard_t)
+                                             + size * sizeof(ngx_hash_elt_t *));
+        if (hinit->hash == NULL) {
+            ngx_free(hashes);
+            return NGX_ERROR;
+        }
+
+        buckets = (ngx_hash_elt_t **)
+                      ((u_char *) hinit->hash + sizeof(ngx_hash_wildcard_t));
+
+    } else {
+        buckets = ngx_pcalloc(hinit->pool, size * sizeof(ngx_hash_elt_t *));
+        if (buckets == NULL) {
+            ngx_free(hashes);
+            return NGX_ERROR;
+        }
+    }
+
+    elts = ngx_palloc(hinit->pool, len + ngx_cacheline_size);
+    if (elts == NULL) {
+        ngx_free(hashes);
+        return NGX_ERROR;
+    }
+
+    elts = ngx_align_ptr(elts, ngx_cacheline_size);
+
+    hinit->hash->buckets = buckets;
+    hinit->hash->size = size;
+    hinit->hash->tags = 0;
+    hinit->hash->disp = disp;
+    hinit->hash->ndisp = ndisp;
+
+    for (n = 0; n < nelts; n++) {
+        if (names[n].key.data == NULL) {
+            continue;
+        }
+
+        i = ngx_hash_perfect_slot(hashes[n], disp[hashes[n] % ndisp], size);
+
+        elt = (ngx_hash_elt_t *) elts;
+
+        elt->value = names[n].value;
+        elt->len = (u_short) names[n].key.len;
+
+        ngx_strlow(elt->name, names[n].key.data, names[n].key.len);
+
+        buckets[i] = elt;
+        elts += NGX_HASH_ELT_SIZE(&names[n]);
+    }
+
+    ngx_free(hashes);
+
+    return NGX_OK;
+}
+
+
+/*
+ * the key_hash of the names is computed by the caller, usually by
+ * ngx_hash_add_key() with ngx_hash_key(); the keys of the fast functions
+ * are computed into the hashes array, so the names of the caller are
+ * left intact
+ */
+
+static void
+ngx_hash_rekey(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts,
+    ngx_uint_t *hashes)
+{
+    ngx_uint_t  n;
+
+    if (hinit->key != ngx_hash_key_fast && hinit->key != ngx_hash_key_lc_fast)
+    {
+        for (n = 0; n < nelts; n++) {
+            hashes[n] = names[n].key_hash;
+        }
+
+        return;
+    }
+
+    for (n = 0; n < nelts; n++) {
+        hashes[n] = names[n].key.data ? hinit->key(names[n].key.data,
+                                                   names[n].key.len)
+                                      : 0;
+    }
+}
+
+
+static ngx_int_t
+ngx_hash_test_size(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
+    ngx_uint_t nelts, ngx_uint_t *hashes, u_short *test, ngx_uint_t size,
+    ngx_uint_t bucket_size)
+{
+    ngx_uint_t  n, key;
+
+    ngx_memzero(test, size * sizeof(u_short));
+
+    for (n = 0; n < nelts; n++) {
+        if (names[n].key.data == NULL) {
+            continue;
+        }
+
+        key = hashes[n] % size;
+        test[key] = (u_short) (test[key] + NGX_HASH_ELT_SIZE(&names[n]));
+
+#if 0
+        ngx_log_error(NGX_LOG_ALERT, hinit->pool->log, 0,
+                      "%ui: %ui %ui \"%V\"",
+                      size, key, test[key], &names[n].key);
+#endif
+
+        if (test[key] > (u_short) bucket_size) {
+            return NGX_DECLINED;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
     ngx_uint_t nelts)
@@ -472,6 +992,16 @@ ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
     ngx_hash_init_t       h;
     ngx_hash_wildcard_t  *wdc;
 
+    /* the lookups hash the labels of the names with ngx_hash() */
+
+    if (hinit->key == ngx_hash_key_fast || hinit->key == ngx_hash_key_lc_fast)
+    {
+        ngx_log_error(NGX_LOG_EMERG, hinit->pool->log, 0,
+                      "could not build %s, the wildcard hashes "
+                      "do not support the fast hash keys", hinit->name);
+        return NGX_ERROR;
+    }
+
     if (ngx_array_init(&curr_names, hinit->temp_pool, nelts,
                        sizeof(ngx_hash_key_t))
         != NGX_OK)
@@ -654,6 +1184,124 @@ ngx_hash_strlow(u_char *dst, u_char *src, size_t n)
 }
 
 
+/*
+ * the keys of ngx_hash_key_fast() and ngx_hash_key_lc_fast() are not
+ * compatible with ngx_hash(), so they cannot be used for wildcard hashes,
+ * and the lookup keys are computed with the same function; ngx_hash_init()
+ * computes the keys of the names itself if hinit->key is one of them
+ */
+
+ngx_uint_t
+ngx_hash_key_fast(u_char *data, size_t len)
+{
+    ngx_uint_t  w, key;
+
+    key = len * NGX_HASH_MUL;
+
+    while (len >= sizeof(ngx_uint_t)) {
+        ngx_memcpy(&w, data, sizeof(ngx_uint_t));
+        key = ngx_hash_mix(key, w);
+
+        data += sizeof(ngx_uint_t);
+        len -= sizeof(ngx_uint_t);
+    }
+
+    if (len) {
+        w = 0;
+        ngx_memcpy(&w, data, len);
+        key = ngx_hash_mix(key, w);
+    }
+
+    return ngx_hash_mix(key, 0);
+}
+
+
+ngx_uint_t
+ngx_hash_key_lc_fast(u_char *data, size_t len)
+{
+    ngx_uint_t  w, key;
+
+    key = len * NGX_HASH_MUL;
+
+    while (len >= sizeof(ngx_uint_t)) {
+        ngx_memcpy(&w, data, sizeof(ngx_uint_t));
+        key = ngx_hash_mix(key, ngx_hash_word_lc(w));
+
+        data += sizeof(ngx_uint_t);
+        len -= sizeof(ngx_uint_t);
+    }
+
+    if (len) {
+        w = 0;
+        ngx_memcpy(&w, data, len);
+        key = ngx_hash_mix(key, ngx_hash_word_lc(w));
+    }
+
+    return ngx_hash_mix(key, 0);
+}
+
+
+ngx_uint_t
+ngx_hash_strlow_fast(u_char *dst, u_char *src, size_t n)
+{
+    ngx_uint_t  w, key;
+
+    key = n * NGX_HASH_MUL;
+
+    while (n >= sizeof(ngx_uint_t)) {
+        ngx_memcpy(&w, src, sizeof(ngx_uint_t));
+        w = ngx_hash_word_lc(w);
+        ngx_memcpy(dst, &w, sizeof(ngx_uint_t));
+
+        key = ngx_hash_mix(key, w);
+
+        dst += sizeof(ngx_uint_t);
+        src += sizeof(ngx_uint_t);
+        n -= sizeof(ngx_uint_t);
+    }
+
+    if (n) {
+        w = 0;
+        ngx_memcpy(&w, src, n);
+        w = ngx_hash_word_lc(w);
+        ngx_memcpy(dst, &w, n);
+
+        key = ngx_hash_mix(key, w);
+    }
+
+    return ngx_hash_mix(key, 0);
+}
+
+
+static ngx_inline ngx_uint_t
+ngx_hash_mix(ngx_uint_t key, ngx_uint_t w)
+{
+    key = (key ^ w) * NGX_HASH_MUL;
+
+    return key ^ (key >> NGX_HASH_SHIFT);
+}
+
+
+/*
+ * the high bit of a byte is set in the "upper" mask if the byte is
+ * in the "A" - "Z" range, the sums do not carry to the next byte
+ */
+
+static ngx_inline ngx_uint_t
+ngx_hash_word_lc(ngx_uint_t w)
+{
+    ngx_uint_t  low, upper;
+
+    low = w & (NGX_HASH_BYTES * 0x7f);
+
+    upper = (low + NGX_HASH_BYTES * (0x80 - 'A'))
+            & ~(low + NGX_HASH_BYTES * (0x80 - 'Z' - 1))
+            & ~w & (NGX_HASH_BYTES * 0x80);
+
+    return w | (upper >> 2);
+}
+
+
 ngx_int_t
 ngx_hash_keys_array_init(ngx_hash_keys_arrays_t *ha, ngx_uint_t type)
 {
@@ -720,6 +1368,13 @@ ngx_hash_add_key(ngx_hash_keys_arrays_t *ha, ngx_str_t *key, void *value,
     ngx_array_t     *keys, *hwc;
     ngx_hash_key_t  *hk;
 
+    if (ngx_hash_keys_grow(ha, ha->keys.nelts + ha->dns_wc_head.nelts
+                               + ha->dns_wc_tail.nelts + 1)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
     last = key->len;
 
     if (flags & NGX_HASH_WILDCARD_KEY) {
@@ -986,3 +1641,234 @@ wildcard:
 
     return NGX_OK;
 }
+
+
+/*
+ * adds the exact keys in bulk: the names are lowercased unless
+ * NGX_HASH_READONLY_KEY is set, sorted, and only the first of the equal
+ * keys is added; on return the added keys are the first *nelts names,
+ * and the duplicates follow them
+ */
+
+ngx_int_t
+ngx_hash_add_keys(ngx_hash_keys_arrays_t *ha, ngx_hash_key_t *names,
+    ngx_uint_t *nelts, ngx_uint_t flags)
+{
+    ngx_str_t       *name;
+    ngx_uint_t       i, j, n, w, indexed;
+    ngx_array_t     *bucket;
+    ngx_hash_key_t  *hk, *keys, key;
+
+    n = *nelts;
+
+    /*
+     * the positions of the names are kept in key_hash while they are
+     * sorted, so the equal keys stay in their order
+     */
+
+    for (i = 0; i < n; i++) {
+        if (!(flags & NGX_HASH_READONLY_KEY)) {
+            ngx_strlow(names[i].key.data, names[i].key.data,
+                       names[i].key.len);
+        }
+
+        names[i].key_hash = i;
+    }
+
+    ngx_qsort(names, n, sizeof(ngx_hash_key_t), ngx_hash_keys_cmp);
+
+    if (ngx_hash_keys_grow(ha, ha->keys.nelts + ha->dns_wc_head.nelts
+                               + ha->dns_wc_tail.nelts + n)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    /*
+     * the equal keys of the names are adjacent, so the index is searched
+     * only if it has the keys added before, either the exact ones or
+     * the exact parts of ".example.com"
+     */
+
+    indexed = ha->keys.nelts + ha->dns_wc_head.nelts;
+
+    keys = ngx_array_push_n(&ha->keys, n);
+    if (keys == NULL) {
+        return NGX_ERROR;
+    }
+
+    w = 0;
+
+    for (i = 0; i < n; i++) {
+        hk = &names[i];
+
+        if (w
+            && hk->key.len == names[w - 1].key.len
+            && ngx_strncmp(hk->key.data, names[w - 1].key.data, hk->key.len)
+               == 0)
+        {
+            continue;
+        }
+
+        hk->key_hash = ngx_hash_key(hk->key.data, hk->key.len);
+
+        bucket = &ha->keys_hash[hk->key_hash % ha->hsize];
+
+        if (bucket->elts == NULL) {
+            if (ngx_array_init(bucket, ha->temp_pool, 4, sizeof(ngx_str_t))
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+        } else if (indexed) {
+            name = bucket->elts;
+
+            for (j = 0; j < bucket->nelts; j++) {
+                if (hk->key.len == name[j].len
+                    && ngx_strncmp(hk->key.data, name[j].data, hk->key.len)
+                       == 0)
+                {
+                    break;
+                }
+            }
+
+            if (j < bucket->nelts) {
+                continue;
+            }
+        }
+
+        name = ngx_array_push(bucket);
+        if (name == NULL) {
+            return NGX_ERROR;
+        }
+
+        *name = hk->key;
+
+        keys[w] = *hk;
+
+        if (i != w) {
+            key = names[w];
+            names[w] = *hk;
+            *hk = key;
+        }
+
+        w++;
+    }
+
+    ha->keys.nelts -= n - w;
+
+    *nelts = w;
+
+    return (w == n) ? NGX_OK : NGX_BUSY;
+}
+
+
+static ngx_int_t
+ngx_hash_keys_grow(ngx_hash_keys_arrays_t *ha, ngx_uint_t n)
+{
+    ngx_uint_t  hsize;
+
+    if (n < ha->hsize * NGX_HASH_KEYS_LOAD) {
+        return NGX_OK;
+    }
+
+    hsize = ha->hsize;
+
+    do {
+        hsize *= NGX_HASH_KEYS_GROW;
+    } while (n >= hsize * NGX_HASH_KEYS_LOAD);
+
+    /* the keys are sums of powers of 31, the size is odd and not 31 * x */
+
+    hsize |= 1;
+
+    while (hsize % 3 == 0 || hsize % 5 == 0 || hsize % 7 == 0
+           || hsize % 31 == 0)
+    {
+        hsize += 2;
+    }
+
+    /* the names of "www.example.*" are kept with the dot, see above */
+
+    if (ngx_hash_keys_rehash(ha, &ha->keys_hash, hsize, 0) != NGX_OK
+        || ngx_hash_keys_rehash(ha, &ha->dns_wc_head_hash, hsize, 0) != NGX_OK
+        || ngx_hash_keys_rehash(ha, &ha->dns_wc_tail_hash, hsize, 1) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    ha->hsize = hsize;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_hash_keys_rehash(ngx_hash_keys_arrays_t *ha, ngx_array_t **index,
+    ngx_uint_t hsize, size_t trim)
+{
+    ngx_str_t    *name, *elt;
+    ngx_uint_t    i, j, k;
+    ngx_array_t  *old, *new;
+
+    old = *index;
+
+    new = ngx_pcalloc(ha->temp_pool, sizeof(ngx_array_t) * hsize);
+    if (new == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < ha->hsize; i++) {
+        name = old[i].elts;
+
+        for (j = 0; j < old[i].nelts; j++) {
+            k = ngx_hash_key(name[j].data, name[j].len - trim) % hsize;
+
+            if (new[k].elts == NULL) {
+                if (ngx_array_init(&new[k], ha->temp_pool, 4,
+                                   sizeof(ngx_str_t))
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+            }
+
+            elt = ngx_array_push(&new[k]);
+            if (elt == NULL) {
+                return NGX_ERROR;
+            }
+
+            *elt = name[j];
+        }
+    }
+
+    *index = new;
+
+    return NGX_OK;
+}
+
+
+static int ngx_libc_cdecl
+ngx_hash_keys_cmp(const void *one, const void *two)
+{
+    int              rc;
+    ngx_hash_key_t  *first, *second;
+
+    first = (ngx_hash_key_t *) one;
+    second = (ngx_hash_key_t *) two;
+
+    /* the keys are grouped, not ordered alphabetically */
+
+    if (first->key.len != second->key.len) {
+        return (first->key.len < second->key.len) ? -1 : 1;
+    }
+
+    rc = ngx_memcmp(first->key.data, second->key.data, first->key.len);
+
+    if (rc != 0) {
+        return rc;
+    }
+
+    return (first->key_hash < second->key_hash) ? -1 : 1;
+}
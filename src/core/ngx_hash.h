@@ -23,6 +23,12 @@ typedef struct {
 typedef struct {
     ngx_hash_elt_t  **buckets;
     ngx_uint_t        size;
+
+    ngx_uint_t        tags;     /* the buckets start with tag arrays */
+
+    /* the displacements of a perfect hash, see ngx_hash_perfect_init() */
+    u_short          *disp;
+    ngx_uint_t        ndisp;
 } ngx_hash_t;
 
 
@@ -73,7 +79,7 @@ typedef struct {
 
 
 typedef struct {
-    ngx_uint_t        hsize;
+    ngx_uint_t        hsize;     /* grows with the number of the keys */
 
     ngx_pool_t       *pool;
     ngx_pool_t       *temp_pool;
@@ -105,6 +111,8 @@ void *ngx_hash_find_combined(ngx_hash_combined_t *hash, ngx_uint_t key,
 
 ngx_int_t ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
     ngx_uint_t nelts);
+ngx_int_t ngx_hash_perfect_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
+    ngx_uint_t nelts);
 ngx_int_t ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
     ngx_uint_t nelts);
 
@@ -112,11 +120,16 @@ ngx_int_t ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
 ngx_uint_t ngx_hash_key(u_char *data, size_t len);
 ngx_uint_t ngx_hash_key_lc(u_char *data, size_t len);
 ngx_uint_t ngx_hash_strlow(u_char *dst, u_char *src, size_t n);
+ngx_uint_t ngx_hash_key_fast(u_char *data, size_t len);
+ngx_uint_t ngx_hash_key_lc_fast(u_char *data, size_t len);
+ngx_uint_t ngx_hash_strlow_fast(u_char *dst, u_char *src, size_t n);
 
 
 ngx_int_t ngx_hash_keys_array_init(ngx_hash_keys_arrays_t *ha, ngx_uint_t type);
 ngx_int_t ngx_hash_add_key(ngx_hash_keys_arrays_t *ha, ngx_str_t *key,
     void *value, ngx_uint_t flags);
+ngx_int_t ngx_hash_add_keys(ngx_hash_keys_arrays_t *ha, ngx_hash_key_t *names,
+    ngx_uint_t *nelts, ngx_uint_t flags);
 
 
 #endif /* _NGX_HASH_H_INCLUDED_ */
@@ -0,0 +1,411 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define ngx_hash_file_elt_size(len, value_len)                                \
+    ngx_align(offsetof(ngx_hash_file_elt_t, name) + (len) + (value_len), 4)
+
+
+static ngx_int_t ngx_hash_file_save(u_char *name, u_char *buf, size_t size,
+    ngx_log_t *log);
+static void ngx_hash_file_cleanup(void *data);
+
+
+ngx_int_t
+ngx_hash_file_write(u_char *name, ngx_hash_key_t *names, ngx_uint_t nelts,
+    ngx_log_t *log)
+{
+    u_char                  *buf;
+    size_t                   length;
+    uint64_t                 total;
+    uint32_t                *buckets;
+    ngx_int_t                rc;
+    ngx_str_t               *value;
+    ngx_uint_t               i, n, size;
+    ngx_hash_file_elt_t     *elt;
+    ngx_hash_file_header_t  *header;
+
+    /* the buckets hold one element on average */
+
+    size = nelts | 1;
+
+    total = sizeof(ngx_hash_file_header_t) + (size + 1) * sizeof(uint32_t);
+
+    buckets = ngx_alloc((size + 1) * sizeof(uint32_t), log);
+    if (buckets == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(buckets, (size + 1) * sizeof(uint32_t));
+
+    for (n = 0; n < nelts; n++) {
+        value = names[n].value;
+
+        if (names[n].key.len > 65535) {
+            ngx_log_error(NGX_LOG_EMERG, log, 0,
+                          "too long key \"%V\" in hash file \"%s\"",
+                          &names[n].key, name);
+            ngx_free(buckets);
+            return NGX_ERROR;
+        }
+
+        /* the offsets are 32-bit, so the file is limited to 4G */
+
+        total += (uint64_t) ngx_hash_file_elt_size(names[n].key.len,
+                                                   value->len);
+
+        if (total > 0xffffffff) {
+            ngx_log_error(NGX_LOG_EMERG, log, 0,
+                          "hash file \"%s\" exceeds 4G", name);
+            ngx_free(buckets);
+            return NGX_ERROR;
+        }
+
+        i = names[n].key_hash % size;
+        buckets[i + 1] += ngx_hash_file_elt_size(names[n].key.len, value->len);
+    }
+
+    /* the sizes of the buckets are turned into their offsets */
+
+    length = sizeof(ngx_hash_file_header_t) + (size + 1) * sizeof(uint32_t);
+
+    buckets[0] = (uint32_t) length;
+
+    for (i = 0; i < size; i++) {
+        length += buckets[i + 1];
+        buckets[i + 1] = (uint32_t) length;
+    }
+
+    buf = ngx_alloc(length, log);
+    if (buf == NULL) {
+        ngx_free(buckets);
+        return NGX_ERROR;
+    }
+
+    header = (ngx_hash_file_header_t *) buf;
+
+    header->magic = NGX_HASH_FILE_MAGIC;
+    header->version = NGX_HASH_FILE_VERSION;
+    header->key_size = sizeof(ngx_uint_t);
+    header->size = (uint32_t) size;
+    header->nelts = (uint32_t) nelts;
+    header->buckets = sizeof(ngx_hash_file_header_t);
+    header->length = (uint32_t) length;
+    header->crc32 = ngx_crc32_short(buf,
+                                 offsetof(ngx_hash_file_header_t, crc32));
+
+    ngx_memcpy(buf + header->buckets, buckets,
+               (size + 1) * sizeof(uint32_t));
+
+    /* buckets[i] is moved to the end of the bucket while it is filled */
+
+    for (n = 0; n < nelts; n++) {
+        value = names[n].value;
+
+        i = names[n].key_hash % size;
+
+        elt = (ngx_hash_file_elt_t *) (buf + buckets[i]);
+
+        ngx_memzero(elt, ngx_hash_file_elt_size(names[n].key.len,
+                                                value->len));
+
+        elt->key = (uint32_t) names[n].key_hash;
+        elt->value_len = (uint32_t) value->len;
+        elt->len = (u_short) names[n].key.len;
+
+        ngx_strlow(elt->name, names[n].key.data, names[n].key.len);
+        ngx_memcpy(elt->name + elt->len, value->data, value->len);
+
+        buckets[i] += ngx_hash_file_elt_size(elt->len, elt->value_len);
+    }
+
+    ngx_free(buckets);
+
+    rc = ngx_hash_file_save(name, buf, length, log);
+
+    ngx_free(buf);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_hash_file_save(u_char *name, u_char *buf, size_t size, ngx_log_t *log)
+{
+    size_t     len;
+    ssize_t    n;
+    u_char    *temp;
+    ngx_fd_t   fd;
+    ngx_err_t  err;
+
+    /*
+     * the file is written under a temporary name and renamed,
+     * so the processes that map the old file keep it intact
+     */
+
+    len = ngx_strlen(name);
+
+    temp = ngx_alloc(len + sizeof(".tmp"), log);
+    if (temp == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(ngx_cpymem(temp, name, len), ".tmp", sizeof(".tmp"));
+
+    fd = ngx_open_file(temp, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                       NGX_FILE_DEFAULT_ACCESS);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", temp);
+        ngx_free(temp);
+        return NGX_ERROR;
+    }
+
+    while (size) {
+        n = ngx_write_fd(fd, buf, size);
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            ngx_log_error(NGX_LOG_CRIT, log, err,
+                          ngx_write_fd_n " \"%s\" failed", temp);
+            goto failed;
+        }
+
+        buf += n;
+        size -= n;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", temp);
+        fd = NGX_INVALID_FILE;
+        goto failed;
+    }
+
+    if (ngx_rename_file(temp, name) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      temp, name);
+        fd = NGX_INVALID_FILE;
+        goto failed;
+    }
+
+    ngx_free(temp);
+
+    return NGX_OK;
+
+failed:
+
+    if (fd != NGX_INVALID_FILE && ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", temp);
+    }
+
+    if (ngx_delete_file(temp) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", temp);
+    }
+
+    ngx_free(temp);
+
+    return NGX_ERROR;
+}
+
+
+ngx_hash_file_t *
+ngx_hash_file_open(ngx_pool_t *pool, u_char *name)
+{
+    u_char                  *p;
+    size_t                   size;
+    ngx_fd_t                 fd;
+    ngx_file_info_t          fi;
+    ngx_hash_file_t         *hf;
+    ngx_pool_cleanup_t      *cln;
+    ngx_hash_file_header_t  *header;
+
+    hf = ngx_pcalloc(pool, sizeof(ngx_hash_file_t));
+    if (hf == NULL) {
+        return NULL;
+    }
+
+    cln = ngx_pool_cleanup_add(pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    hf->name = name;
+    hf->log = pool->log;
+
+    fd = ngx_open_file(name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ERR, pool->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name);
+        return NULL;
+    }
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, pool->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name);
+        goto failed;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    if (size < sizeof(ngx_hash_file_header_t)) {
+        goto invalid;
+    }
+
+    p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (p == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_CRIT, pool->log, ngx_errno,
+                      "mmap(%uz) \"%s\" failed", size, name);
+        goto failed;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, pool->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+
+    fd = NGX_INVALID_FILE;
+
+    hf->start = p;
+    hf->length = size;
+
+    cln->handler = ngx_hash_file_cleanup;
+    cln->data = hf;
+
+    /*
+     * only the header is checked, so the startup does not read the whole
+     * file; the lookups check that the buckets and elements are in the file
+     */
+
+    header = (ngx_hash_file_header_t *) p;
+
+    if (header->magic != NGX_HASH_FILE_MAGIC
+        || header->version != NGX_HASH_FILE_VERSION
+        || header->key_size != sizeof(ngx_uint_t)
+        || header->crc32
+           != ngx_crc32_short(p, offsetof(ngx_hash_file_header_t, crc32))
+        || header->length != size
+        || header->size == 0
+        || header->buckets < sizeof(ngx_hash_file_header_t)
+        || header->buckets % sizeof(uint32_t)
+        || header->buckets > size
+        || (size - header->buckets) / sizeof(uint32_t)
+           < (uint64_t) header->size + 1)
+    {
+        goto invalid;
+    }
+
+    hf->buckets = (uint32_t *) (p + header->buckets);
+    hf->size = header->size;
+    hf->nelts = header->nelts;
+
+    return hf;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, pool->log, 0, "invalid hash file \"%s\"", name);
+
+    if (hf->start) {
+        ngx_hash_file_cleanup(hf);
+        cln->handler = NULL;
+    }
+
+failed:
+
+    if (fd != NGX_INVALID_FILE && ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, pool->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+
+    return NULL;
+}
+
+
+ngx_int_t
+ngx_hash_file_find(ngx_hash_file_t *hf, ngx_uint_t key, u_char *name,
+    size_t len, ngx_str_t *value)
+{
+    u_char               *p, *last;
+    uint32_t              start, end;
+    ngx_uint_t            n;
+    ngx_hash_file_elt_t  *elt;
+
+    n = key % hf->size;
+
+    start = hf->buckets[n];
+    end = hf->buckets[n + 1];
+
+    if (end > hf->length
+        || start > end
+        || start % sizeof(uint32_t)
+        || end % sizeof(uint32_t))
+    {
+        goto invalid;
+    }
+
+    p = hf->start + start;
+    last = hf->start + end;
+
+    while (p < last) {
+        elt = (ngx_hash_file_elt_t *) p;
+
+        if ((size_t) (last - p) < offsetof(ngx_hash_file_elt_t, name)
+            || (size_t) (last - p)
+               < ngx_hash_file_elt_size(elt->len, elt->value_len))
+        {
+            goto invalid;
+        }
+
+        if (elt->key == (uint32_t) key
+            && elt->len == len
+            && ngx_strncmp(elt->name, name, len) == 0)
+        {
+            value->len = elt->value_len;
+            value->data = elt->name + len;
+
+            return NGX_OK;
+        }
+
+        p += ngx_hash_file_elt_size(elt->len, elt->value_len);
+    }
+
+    return NGX_DECLINED;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ALERT, hf->log, 0,
+                  "corrupted bucket %ui in hash file \"%s\"", n, hf->name);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_hash_file_cleanup(void *data)
+{
+    ngx_hash_file_t *hf = data;
+
+    if (munmap(hf->start, hf->length) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, hf->log, ngx_errno,
+                      "munmap(%p, %uz) \"%s\" failed",
+                      hf->start, hf->length, hf->name);
+    }
+}
@@ -0,0 +1,73 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_HASH_FILE_H_INCLUDED_
+#define _NGX_HASH_FILE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/*
+ * a hash of strings in a file that is mapped read-only, so the pages
+ * are shared by all processes through the page cache; the file holds
+ * offsets instead of pointers:
+ *
+ *     the header;
+ *     size + 1 offsets of the buckets, a bucket ends where the next starts;
+ *     the elements of the buckets, each is ngx_hash_file_elt_t followed
+ *     by the name, the value, and the padding to 4 bytes
+ *
+ * the numbers are in the byte order of the host that has written the file,
+ * and the keys are computed by ngx_hash_key() in its ngx_uint_t, so a file
+ * with another byte order or key size is rejected by the magic and key_size
+ */
+
+#define NGX_HASH_FILE_MAGIC    0x4858474e    /* "NGXH" */
+#define NGX_HASH_FILE_VERSION  1
+
+
+typedef struct {
+    uint32_t          magic;
+    uint32_t          version;
+    uint32_t          key_size;
+    uint32_t          size;
+    uint32_t          nelts;
+    uint32_t          buckets;     /* the offset of the buckets */
+    uint32_t          length;      /* the file size */
+    uint32_t          crc32;       /* of the header before this field */
+} ngx_hash_file_header_t;
+
+
+typedef struct {
+    uint32_t          key;         /* the low 32 bits of the key */
+    uint32_t          value_len;
+    u_short           len;
+    u_char            name[1];
+} ngx_hash_file_elt_t;
+
+
+typedef struct {
+    u_char           *start;
+    size_t            length;
+    uint32_t         *buckets;
+    ngx_uint_t        size;
+    ngx_uint_t        nelts;
+    u_char           *name;
+    ngx_log_t        *log;
+} ngx_hash_file_t;
+
+
+ngx_int_t ngx_hash_file_write(u_char *name, ngx_hash_key_t *names,
+    ngx_uint_t nelts, ngx_log_t *log);
+ngx_hash_file_t *ngx_hash_file_open(ngx_pool_t *pool, u_char *name);
+ngx_int_t ngx_hash_file_find(ngx_hash_file_t *hf, ngx_uint_t key,
+    u_char *name, size_t len, ngx_str_t *value);
+
+
+#endif /* _NGX_HASH_FILE_H_INCLUDED_ */
@@ -0,0 +1,401 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_hash_rcu.h>
+
+
+static ngx_int_t ngx_hash_rcu_start(ngx_hash_rcu_t *rh,
+    ngx_hash_rcu_version_t *v);
+#if (NGX_THREADS)
+static void ngx_hash_rcu_thread_handler(void *data, ngx_log_t *log);
+static void ngx_hash_rcu_build_handler(ngx_event_t *ev);
+#endif
+static ngx_int_t ngx_hash_rcu_publish(ngx_hash_rcu_t *rh,
+    ngx_hash_rcu_version_t *v);
+static void ngx_hash_rcu_reclaim_handler(ngx_event_t *ev);
+static void ngx_hash_rcu_free(ngx_hash_rcu_version_t *v);
+static void ngx_hash_rcu_cleanup(void *data);
+
+
+ngx_hash_rcu_t *
+ngx_hash_rcu_create(ngx_pool_t *pool, char *name, ngx_uint_t max_size,
+    ngx_uint_t bucket_size)
+{
+    ngx_hash_rcu_t      *rh;
+    ngx_pool_cleanup_t  *cln;
+
+    rh = ngx_pcalloc(pool, sizeof(ngx_hash_rcu_t));
+    if (rh == NULL) {
+        return NULL;
+    }
+
+    cln = ngx_pool_cleanup_add(pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    cln->handler = ngx_hash_rcu_cleanup;
+    cln->data = rh;
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     rh->current = NULL;
+     *     rh->building = NULL;
+     *     rh->pending = NULL;
+     *     rh->retired = NULL;
+     *     rh->handler = NULL;
+     *     rh->data = NULL;
+     *     rh->thread_pool = NULL;
+     *     rh->versions = 0;
+     *     rh->nretired = 0;
+     */
+
+    rh->last = &rh->retired;
+
+    rh->key = ngx_hash_key;
+    rh->max_size = max_size;
+    rh->bucket_size = bucket_size;
+    rh->name = name;
+
+    rh->grace = NGX_HASH_RCU_GRACE;
+    rh->log = pool->log;
+
+    rh->reclaim.handler = ngx_hash_rcu_reclaim_handler;
+    rh->reclaim.data = rh;
+    rh->reclaim.log = pool->log;
+    rh->reclaim.cancelable = 1;
+
+    return rh;
+}
+
+
+ngx_int_t
+ngx_hash_rcu_update(ngx_hash_rcu_t *rh, ngx_hash_key_t *names,
+    ngx_uint_t nelts)
+{
+    ngx_uint_t               n;
+    ngx_pool_t              *pool;
+    ngx_hash_key_t          *name;
+    ngx_hash_rcu_version_t  *v;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, rh->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    v = ngx_pcalloc(pool, sizeof(ngx_hash_rcu_version_t));
+    if (v == NULL) {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    v->pool = pool;
+
+    v->temp_pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, rh->log);
+    if (v->temp_pool == NULL) {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    /*
+     * the keys are copied as the build may run in a thread after
+     * the caller has reused the names
+     */
+
+    v->names = ngx_palloc(v->temp_pool, nelts * sizeof(ngx_hash_key_t));
+    if (v->names == NULL) {
+        ngx_hash_rcu_free(v);
+        return NGX_ERROR;
+    }
+
+    for (n = 0; n < nelts; n++) {
+        name = &v->names[n];
+
+        name->key.len = names[n].key.len;
+        name->key.data = ngx_pstrdup(v->temp_pool, &names[n].key);
+        if (name->key.data == NULL) {
+            ngx_hash_rcu_free(v);
+            return NGX_ERROR;
+        }
+
+        name->key_hash = rh->key(name->key.data, name->key.len);
+        name->value = names[n].value;
+    }
+
+    v->nelts = nelts;
+
+    v->init.hash = &v->hash;
+    v->init.key = rh->key;
+    v->init.max_size = rh->max_size;
+    v->init.bucket_size = rh->bucket_size;
+    v->init.name = rh->name;
+    v->init.pool = v->pool;
+    v->init.temp_pool = v->temp_pool;
+
+    v->number = ++rh->versions;
+    v->rcu = rh;
+
+    if (rh->building) {
+
+        /* only the last of the updates made during a build is kept */
+
+        if (rh->pending) {
+            ngx_hash_rcu_free(rh->pending);
+        }
+
+        rh->pending = v;
+
+        return NGX_AGAIN;
+    }
+
+    return ngx_hash_rcu_start(rh, v);
+}
+
+
+void *
+ngx_hash_rcu_find(ngx_hash_rcu_t *rh, ngx_uint_t key, u_char *name,
+    size_t len)
+{
+    ngx_hash_rcu_version_t  *v;
+
+    v = rh->current;
+
+    if (v == NULL) {
+        return NULL;
+    }
+
+    return ngx_hash_find(&v->hash, key, name, len);
+}
+
+
+static ngx_int_t
+ngx_hash_rcu_start(ngx_hash_rcu_t *rh, ngx_hash_rcu_version_t *v)
+{
+#if (NGX_THREADS)
+
+    ngx_thread_task_t  *task;
+
+    if (rh->thread_pool) {
+
+        task = ngx_thread_task_alloc(v->pool, 0);
+        if (task == NULL) {
+            ngx_hash_rcu_free(v);
+            return NGX_ERROR;
+        }
+
+        task->ctx = v;
+        task->handler = ngx_hash_rcu_thread_handler;
+
+        task->event.data = v;
+        task->event.handler = ngx_hash_rcu_build_handler;
+        task->event.log = rh->log;
+
+        /* the hash and its temporary data are allocated in the thread */
+
+        v->pool->nocache = 1;
+        v->temp_pool->nocache = 1;
+
+        if (ngx_thread_task_post(rh->thread_pool, task) != NGX_OK) {
+            ngx_hash_rcu_free(v);
+            return NGX_ERROR;
+        }
+
+        rh->building = v;
+
+        return NGX_AGAIN;
+    }
+
+#endif
+
+    v->rc = ngx_hash_init(&v->init, v->names, v->nelts);
+
+    return ngx_hash_rcu_publish(rh, v);
+}
+
+
+#if (NGX_THREADS)
+
+static void
+ngx_hash_rcu_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_hash_rcu_version_t *v = data;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "%s hash version %ui build", v->init.name, v->number);
+
+    v->rc = ngx_hash_init(&v->init, v->names, v->nelts);
+}
+
+
+static void
+ngx_hash_rcu_build_handler(ngx_event_t *ev)
+{
+    ngx_hash_rcu_t          *rh;
+    ngx_hash_rcu_version_t  *v;
+
+    v = ev->data;
+    rh = v->rcu;
+
+    if (rh == NULL) {
+        ngx_hash_rcu_free(v);
+        return;
+    }
+
+    rh->building = NULL;
+
+    (void) ngx_hash_rcu_publish(rh, v);
+
+    if (rh->pending) {
+        v = rh->pending;
+        rh->pending = NULL;
+
+        (void) ngx_hash_rcu_start(rh, v);
+    }
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_hash_rcu_publish(ngx_hash_rcu_t *rh, ngx_hash_rcu_version_t *v)
+{
+    ngx_int_t                rc;
+    ngx_hash_rcu_version_t  *old;
+
+    ngx_destroy_pool(v->temp_pool);
+    v->temp_pool = NULL;
+
+    rc = v->rc;
+
+    if (rc != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, rh->log, 0,
+                      "%s hash version %ui not built, "
+                      "the previous version is kept", rh->name, v->number);
+
+        ngx_hash_rcu_free(v);
+        goto done;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, rh->log, 0,
+                   "%s hash version %ui published", rh->name, v->number);
+
+    old = rh->current;
+
+    /* the hash is complete before the readers may see it */
+
+    ngx_memory_barrier();
+
+    rh->current = v;
+
+    if (old == NULL) {
+        goto done;
+    }
+
+    old->retired = ngx_current_msec;
+    old->next = NULL;
+
+    *rh->last = old;
+    rh->last = &old->next;
+    rh->nretired++;
+
+    if (!rh->reclaim.timer_set) {
+        ngx_add_timer(&rh->reclaim, rh->grace);
+    }
+
+done:
+
+    if (rh->handler) {
+        rh->handler(rh, rc);
+    }
+
+    return rc;
+}
+
+
+static void
+ngx_hash_rcu_reclaim_handler(ngx_event_t *ev)
+{
+    ngx_msec_int_t           elapsed;
+    ngx_hash_rcu_t          *rh;
+    ngx_hash_rcu_version_t  *v;
+
+    rh = ev->data;
+
+    /* the versions are retired in order, the oldest is the first */
+
+    while (rh->retired) {
+        v = rh->retired;
+
+        elapsed = (ngx_msec_int_t) (ngx_current_msec - v->retired);
+
+        if (elapsed < (ngx_msec_int_t) rh->grace) {
+            ngx_add_timer(ev, rh->grace - elapsed);
+            return;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                       "%s hash version %ui freed", rh->name, v->number);
+
+        rh->retired = v->next;
+        rh->nretired--;
+
+        ngx_hash_rcu_free(v);
+    }
+
+    rh->last = &rh->retired;
+}
+
+
+static void
+ngx_hash_rcu_free(ngx_hash_rcu_version_t *v)
+{
+    if (v->temp_pool) {
+        ngx_destroy_pool(v->temp_pool);
+    }
+
+    /* the version is allocated from its own pool */
+
+    ngx_destroy_pool(v->pool);
+}
+
+
+static void
+ngx_hash_rcu_cleanup(void *data)
+{
+    ngx_hash_rcu_t *rh = data;
+
+    ngx_hash_rcu_version_t  *v;
+
+    if (rh->reclaim.timer_set) {
+        ngx_del_timer(&rh->reclaim);
+    }
+
+    /* a version being built is freed by its completion handler */
+
+    if (rh->building) {
+        rh->building->rcu = NULL;
+    }
+
+    if (rh->pending) {
+        ngx_hash_rcu_free(rh->pending);
+    }
+
+    while (rh->retired) {
+        v = rh->retired;
+        rh->retired = v->next;
+
+        ngx_hash_rcu_free(v);
+    }
+
+    if (rh->current) {
+        ngx_hash_rcu_free(rh->current);
+    }
+}
@@ -0,0 +1,95 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_HASH_RCU_H_INCLUDED_
+#define _NGX_HASH_RCU_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
+
+
+/*
+ * a hash that may be replaced at run time: each update builds a new
+ * version of the hash from the full set of keys, in a thread pool if
+ * it is set, and publishes it with a single pointer store, so readers
+ * never lock; as a reader may still use the version it has loaded
+ * before the store, the replaced versions are freed after a grace period
+ */
+
+typedef struct ngx_hash_rcu_s          ngx_hash_rcu_t;
+typedef struct ngx_hash_rcu_version_s  ngx_hash_rcu_version_t;
+
+typedef void (*ngx_hash_rcu_handler_pt)(ngx_hash_rcu_t *rh, ngx_int_t rc);
+
+
+struct ngx_hash_rcu_version_s {
+    ngx_hash_t               hash;
+    ngx_hash_init_t          init;
+
+    ngx_uint_t               number;
+    ngx_msec_t               retired;
+
+    ngx_pool_t              *pool;       /* the version itself and its hash */
+    ngx_pool_t              *temp_pool;  /* the copy of the keys */
+
+    ngx_hash_key_t          *names;
+    ngx_uint_t               nelts;
+    ngx_int_t                rc;
+
+    ngx_hash_rcu_t          *rcu;        /* NULL if the hash is destroyed */
+    ngx_hash_rcu_version_t  *next;
+};
+
+
+struct ngx_hash_rcu_s {
+    ngx_hash_rcu_version_t * volatile   current;
+
+    ngx_hash_rcu_version_t   *building;
+    ngx_hash_rcu_version_t   *pending;
+    ngx_hash_rcu_version_t   *retired;
+    ngx_hash_rcu_version_t  **last;
+
+    ngx_hash_key_pt           key;
+    ngx_uint_t                max_size;
+    ngx_uint_t                bucket_size;
+    char                     *name;
+
+    ngx_msec_t                grace;
+    ngx_event_t               reclaim;
+
+    ngx_hash_rcu_handler_pt   handler;   /* called after each update */
+    void                     *data;
+
+#if (NGX_THREADS)
+    ngx_thread_pool_t        *thread_pool;
+#endif
+
+    ngx_log_t                *log;
+
+    ngx_uint_t                versions;
+    ngx_uint_t                nretired;
+};
+
+
+#define NGX_HASH_RCU_GRACE  1000
+
+
+ngx_hash_rcu_t *ngx_hash_rcu_create(ngx_pool_t *pool, char *name,
+    ngx_uint_t max_size, ngx_uint_t bucket_size);
+ngx_int_t ngx_hash_rcu_update(ngx_hash_rcu_t *rh, ngx_hash_key_t *names,
+    ngx_uint_t nelts);
+void *ngx_hash_rcu_find(ngx_hash_rcu_t *rh, ngx_uint_t key, u_char *name,
+    size_t len);
+
+
+#endif /* _NGX_HASH_RCU_H_INCLUDED_ */
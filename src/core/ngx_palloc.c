@@ -9,10 +9,85 @@
 #include <ngx_core.h>
 
 
+#if (NGX_STAT_POOL)
+#undef ngx_palloc
+#undef ngx_pnalloc
+#undef ngx_pcalloc
+#undef ngx_pmemalign
+#endif
+
+
+typedef struct {
+    ngx_uint_t   cache;
+} ngx_pool_conf_t;
+
+
 static ngx_inline void *ngx_palloc_small(ngx_pool_t *pool, size_t size,
     ngx_uint_t align);
 static void *ngx_palloc_block(ngx_pool_t *pool, size_t size);
 static void *ngx_palloc_large(ngx_pool_t *pool, size_t size);
+static ngx_int_t ngx_pool_large_add(ngx_pool_t *pool, void *p, size_t size);
+static ngx_int_t ngx_pool_large_hash(ngx_pool_t *pool);
+static ngx_int_t ngx_pool_budget(ngx_pool_t *pool, size_t size);
+static size_t ngx_pool_block_size(size_t size);
+static void *ngx_alloc_block(size_t size, ngx_log_t *log);
+static void ngx_free_block(void *p, size_t size);
+#if (NGX_STAT_POOL)
+static void ngx_pool_stat_site(char *file, ngx_uint_t line, size_t size);
+static int ngx_libc_cdecl ngx_pool_cmp_sites(const void *one,
+    const void *two);
+#endif
+
+static char *ngx_pool_set_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static void *ngx_pool_create_conf(ngx_cycle_t *cycle);
+static char *ngx_pool_init_conf(ngx_cycle_t *cycle, void *conf);
+static ngx_int_t ngx_pool_init_worker(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_pool_commands[] = {
+
+    { ngx_string("pool_cache"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_pool_set_cache,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_core_module_t  ngx_pool_module_ctx = {
+    ngx_string("pool"),
+    ngx_pool_create_conf,
+    ngx_pool_init_conf
+};
+
+
+ngx_module_t  ngx_pool_module = {
+    NGX_MODULE_V1,
+    &ngx_pool_module_ctx,                  /* module context */
+    ngx_pool_commands,                     /* module directives */
+    NGX_CORE_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_pool_init_worker,                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+ngx_cached_block_slot_t  ngx_pool_cache[NGX_POOL_CACHE_SLOTS];
+
+static ngx_uint_t  ngx_pool_cache_max;
+
+#if (NGX_STAT_POOL)
+static ngx_pool_site_t  ngx_pool_sites[NGX_POOL_STAT_SITES];
+#endif
 
 
 ngx_pool_t *
@@ -20,7 +95,9 @@ ngx_create_pool(size_t size, ngx_log_t *log)
 {
     ngx_pool_t  *p;
 
-    p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    size = ngx_pool_block_size(size);
+
+    p = ngx_alloc_block(size, log);
     if (p == NULL) {
         return NULL;
     }
@@ -33,12 +110,31 @@ ngx_create_pool(size_t size, ngx_log_t *log)
     size = size - sizeof(ngx_pool_t);
     p->max = (size < NGX_MAX_ALLOC_FROM_POOL) ? size : NGX_MAX_ALLOC_FROM_POOL;
 
+    p->block_size = (size_t) (p->d.end - (u_char *) p);
+
     p->current = p;
     p->chain = NULL;
     p->large = NULL;
     p->cleanup = NULL;
     p->log = log;
 
+    p->large_free = NULL;
+    p->large_hash = NULL;
+    p->large_hash_size = 0;
+    p->nlarge = 0;
+
+    p->size = p->block_size;
+    p->budget = 0;
+    p->budget_handler = NULL;
+    p->budget_data = NULL;
+
+    p->nocache = 0;
+
+#if (NGX_STAT_POOL)
+    ngx_memzero(&p->stats, sizeof(ngx_pool_stat_t));
+    p->stats.blocks = 1;
+#endif
+
     return p;
 }
 
@@ -86,8 +182,12 @@ ngx_destroy_pool(ngx_pool_t *pool)
         }
     }
 
+    if (pool->large_hash) {
+        ngx_free(pool->large_hash);
+    }
+
     for (p = pool, n = pool->d.next; /* void */; p = n, n = n->d.next) {
-        ngx_free(p);
+        ngx_free_block(p, p->d.end - (u_char *) p);
 
         if (n == NULL) {
             break;
@@ -99,7 +199,7 @@ ngx_destroy_pool(ngx_pool_t *pool)
 void
 ngx_reset_pool(ngx_pool_t *pool)
 {
-    ngx_pool_t        *p;
+    ngx_pool_t        *p, *n;
     ngx_pool_large_t  *l;
 
     for (l = pool->large; l; l = l->next) {
@@ -108,6 +208,23 @@ ngx_reset_pool(ngx_pool_t *pool)
         }
     }
 
+    if (pool->large_hash) {
+        ngx_free(pool->large_hash);
+    }
+
+    if (ngx_pool_cache_max) {
+
+        /* return all blocks but the first one to the cache */
+
+        for (p = pool->d.next; p; p = n) {
+            n = p->d.next;
+            ngx_free_block(p, p->d.end - (u_char *) p);
+        }
+
+        pool->d.next = NULL;
+        pool->block_size = (size_t) (pool->d.end - (u_char *) pool);
+    }
+
     for (p = pool; p; p = p->d.next) {
         p->d.last = (u_char *) p + sizeof(ngx_pool_t);
         p->d.failed = 0;
@@ -116,12 +233,133 @@ ngx_reset_pool(ngx_pool_t *pool)
     pool->current = pool;
     pool->chain = NULL;
     pool->large = NULL;
+
+    pool->large_free = NULL;
+    pool->large_hash = NULL;
+    pool->large_hash_size = 0;
+    pool->nlarge = 0;
+
+    pool->size = 0;
+
+#if (NGX_STAT_POOL)
+    pool->stats.blocks = 0;
+#endif
+
+    for (p = pool; p; p = p->d.next) {
+        pool->size += p->d.end - (u_char *) p;
+
+#if (NGX_STAT_POOL)
+        pool->stats.blocks++;
+#endif
+    }
+}
+
+
+void
+ngx_pool_mark(ngx_pool_t *pool, ngx_pool_mark_t *mark)
+{
+    ngx_pool_t  *p;
+
+    for (p = pool->current; p->d.next; p = p->d.next) { /* void */ }
+
+    mark->current = pool->current;
+    mark->last = p;
+    mark->pos = p->d.last;
+    mark->failed = p->d.failed;
+    mark->block_size = pool->block_size;
+    mark->chain = pool->chain;
+    mark->large = pool->large;
+    mark->large_free = pool->large_free;
+    mark->cleanup = pool->cleanup;
+
+    /*
+     * the allocations after the mark are made from the last block
+     * and from the new blocks only, and the large allocations get
+     * the new slots, so all of them can be released at once
+     */
+
+    pool->current = p;
+    pool->chain = NULL;
+    pool->large_free = NGX_POOL_LARGE_PARKED;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
+                   "pool mark: %p:%p", p, p->d.last);
+}
+
+
+void
+ngx_pool_rollback(ngx_pool_t *pool, ngx_pool_mark_t *mark)
+{
+    ngx_pool_t          *p, *n;
+    ngx_pool_large_t    *l;
+    ngx_pool_cleanup_t  *c;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
+                   "pool rollback: %p:%p", mark->last, mark->pos);
+
+    for (c = pool->cleanup; c != mark->cleanup; c = c->next) {
+        if (c->handler) {
+            ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
+                           "run cleanup: %p", c);
+            c->handler(c->data);
+        }
+    }
+
+    pool->cleanup = mark->cleanup;
+
+    for (l = pool->large; l != mark->large; l = l->next) {
+        if (l->alloc) {
+            (void) ngx_pfree(pool, l->alloc);
+        }
+    }
+
+    pool->large = mark->large;
+    pool->large_free = mark->large_free;
+
+    p = mark->last;
+
+    for (n = p->d.next; n; n = p->d.next) {
+        p->d.next = n->d.next;
+
+        pool->size -= n->d.end - (u_char *) n;
+
+#if (NGX_STAT_POOL)
+        pool->stats.blocks--;
+#endif
+
+        ngx_free_block(n, n->d.end - (u_char *) n);
+    }
+
+    p->d.last = mark->pos;
+    p->d.failed = mark->failed;
+
+    /* the blocks after the mark are freed, so their growth is undone */
+
+    pool->block_size = mark->block_size;
+
+    pool->current = mark->current;
+    pool->chain = mark->chain;
+}
+
+
+void
+ngx_pool_set_budget(ngx_pool_t *pool, size_t budget,
+    ngx_pool_budget_pt handler, void *data)
+{
+    pool->budget = budget;
+    pool->budget_handler = handler;
+    pool->budget_data = data;
 }
 
 
 void *
 ngx_palloc(ngx_pool_t *pool, size_t size)
 {
+#if (NGX_STAT_POOL)
+    pool->stats.requested += size;
+    pool->stats.allocs++;
+#endif
+
 #if !(NGX_DEBUG_PALLOC)
     if (size <= pool->max) {
         return ngx_palloc_small(pool, size, 1);
@@ -135,6 +373,11 @@ ngx_palloc(ngx_pool_t *pool, size_t size)
 void *
 ngx_pnalloc(ngx_pool_t *pool, size_t size)
 {
+#if (NGX_STAT_POOL)
+    pool->stats.requested += size;
+    pool->stats.allocs++;
+#endif
+
 #if !(NGX_DEBUG_PALLOC)
     if (size <= pool->max) {
         return ngx_palloc_small(pool, size, 0);
@@ -179,17 +422,41 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 {
     u_char      *m;
     size_t       psize;
+    ngx_uint_t   advance;
     ngx_pool_t  *p, *new;
 
-    psize = (size_t) (pool->d.end - (u_char *) pool);
+    psize = pool->block_size;
+
+    if (pool->budget && ngx_pool_budget(pool, psize) != NGX_OK) {
+        return NULL;
+    }
+
+    if (pool->nocache) {
+        m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+
+    } else {
+        m = ngx_alloc_block(psize, pool->log);
+    }
 
-    m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
     if (m == NULL) {
         return NULL;
     }
 
+    if (psize < NGX_MAX_POOL_BLOCK_SIZE / 2) {
+        pool->block_size = ngx_pool_block_size(2 * psize);
+
+    } else if (psize < NGX_MAX_POOL_BLOCK_SIZE) {
+        pool->block_size = NGX_MAX_POOL_BLOCK_SIZE;
+    }
+
     new = (ngx_pool_t *) m;
 
+    pool->size += psize;
+
+#if (NGX_STAT_POOL)
+    pool->stats.blocks++;
+#endif
+
     new->d.end = m + psize;
     new->d.next = NULL;
     new->d.failed = 0;
@@ -198,9 +465,24 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
     m = ngx_align_ptr(m, NGX_ALIGNMENT);
     new->d.last = m + size;
 
+    /*
+     * the current block is moved only over the leading blocks that are
+     * nearly full or failed too often, so a block that still has room
+     * is not skipped
+     */
+
+    advance = 1;
+
     for (p = pool->current; p->d.next; p = p->d.next) {
-        if (p->d.failed++ > 4) {
-            pool->current = p->d.next;
+        if (p->d.failed++ > 4
+            || (size_t) (p->d.end - p->d.last) < NGX_POOL_BLOCK_SLACK)
+        {
+            if (advance) {
+                pool->current = p->d.next;
+            }
+
+        } else {
+            advance = 0;
         }
     }
 
@@ -213,38 +495,22 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 static void *
 ngx_palloc_large(ngx_pool_t *pool, size_t size)
 {
-    void              *p;
-    ngx_uint_t         n;
-    ngx_pool_large_t  *large;
+    void  *p;
 
-    p = ngx_alloc(size, pool->log);
-    if (p == NULL) {
+    if (pool->budget && ngx_pool_budget(pool, size) != NGX_OK) {
         return NULL;
     }
 
-    n = 0;
-
-    for (large = pool->large; large; large = large->next) {
-        if (large->alloc == NULL) {
-            large->alloc = p;
-            return p;
-        }
-
-        if (n++ > 3) {
-            break;
-        }
+    p = ngx_alloc(size, pool->log);
+    if (p == NULL) {
+        return NULL;
     }
 
-    large = ngx_palloc_small(pool, sizeof(ngx_pool_large_t), 1);
-    if (large == NULL) {
+    if (ngx_pool_large_add(pool, p, size) != NGX_OK) {
         ngx_free(p);
         return NULL;
     }
 
-    large->alloc = p;
-    large->next = pool->large;
-    pool->large = large;
-
     return p;
 }
 
@@ -252,45 +518,213 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
 void *
 ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
 {
-    void              *p;
-    ngx_pool_large_t  *large;
+    void  *p;
+
+#if (NGX_STAT_POOL)
+    pool->stats.requested += size;
+    pool->stats.allocs++;
+#endif
+
+    if (pool->budget && ngx_pool_budget(pool, size) != NGX_OK) {
+        return NULL;
+    }
 
     p = ngx_memalign(alignment, size, pool->log);
     if (p == NULL) {
         return NULL;
     }
 
-    large = ngx_palloc_small(pool, sizeof(ngx_pool_large_t), 1);
-    if (large == NULL) {
+    if (ngx_pool_large_add(pool, p, size) != NGX_OK) {
         ngx_free(p);
         return NULL;
     }
 
+    return p;
+}
+
+
+/*
+ * the low bits of the product depend only on the low bits of the address,
+ * and mmap()ed blocks all start at the same page offset, so the key
+ * is taken from the high half of a 64-bit multiplicative hash
+ */
+
+#define ngx_pool_large_key(p, size)                                           \
+    ((ngx_uint_t) ((((uint64_t) (uintptr_t) (p) >> 4)                         \
+                    * 0x9e3779b97f4a7c15ULL) >> 32)                           \
+     & ((size) - 1))
+
+
+static ngx_int_t
+ngx_pool_large_add(ngx_pool_t *pool, void *p, size_t size)
+{
+    ngx_uint_t         key;
+    ngx_pool_large_t  *large;
+#if (NGX_STAT_POOL)
+    ngx_uint_t         i, n;
+#endif
+
+    large = pool->large_free;
+
+    if (large && large != NGX_POOL_LARGE_PARKED) {
+        pool->large_free = large->link;
+
+    } else {
+        large = ngx_palloc_small(pool, sizeof(ngx_pool_large_t), 1);
+        if (large == NULL) {
+            return NGX_ERROR;
+        }
+
+        large->next = pool->large;
+        pool->large = large;
+    }
+
     large->alloc = p;
-    large->next = pool->large;
-    pool->large = large;
+    large->link = NULL;
 
-    return p;
+    large->size = size;
+
+    pool->nlarge++;
+    pool->size += size;
+
+#if (NGX_STAT_POOL)
+    n = size >> ngx_pagesize_shift;
+
+    for (i = 0; n > 1 && i < NGX_POOL_STAT_LARGE - 1; i++) {
+        n >>= 1;
+    }
+
+    pool->stats.large[i]++;
+#endif
+
+    if (pool->large_hash == NULL) {
+
+        if (pool->nlarge > NGX_POOL_LARGE_HASH) {
+            /* the failure is not fatal, ngx_pfree() falls back to the list */
+            (void) ngx_pool_large_hash(pool);
+        }
+
+        return NGX_OK;
+    }
+
+    if (pool->nlarge > pool->large_hash_size
+        && ngx_pool_large_hash(pool) == NGX_OK)
+    {
+        return NGX_OK;
+    }
+
+    key = ngx_pool_large_key(p, pool->large_hash_size);
+
+    large->link = pool->large_hash[key];
+    pool->large_hash[key] = large;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_pool_large_hash(ngx_pool_t *pool)
+{
+    ngx_uint_t          key, size;
+    ngx_pool_large_t   *l, **hash;
+
+    size = pool->large_hash_size ? pool->large_hash_size * 2
+                                 : 4 * NGX_POOL_LARGE_HASH;
+
+    hash = ngx_alloc(size * sizeof(ngx_pool_large_t *), pool->log);
+    if (hash == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(hash, size * sizeof(ngx_pool_large_t *));
+
+    for (l = pool->large; l; l = l->next) {
+        if (l->alloc == NULL) {
+            continue;
+        }
+
+        key = ngx_pool_large_key(l->alloc, size);
+
+        l->link = hash[key];
+        hash[key] = l;
+    }
+
+    if (pool->large_hash) {
+        ngx_free(pool->large_hash);
+    }
+
+    pool->large_hash = hash;
+    pool->large_hash_size = size;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_pool_budget(ngx_pool_t *pool, size_t size)
+{
+    if (pool->size + size <= pool->budget) {
+        return NGX_OK;
+    }
+
+    if (pool->budget_handler
+        && pool->budget_handler(pool, size, pool->budget_data) == NGX_OK)
+    {
+        return NGX_OK;
+    }
+
+    ngx_log_error(NGX_LOG_ERR, pool->log, 0,
+                  "pool budget of %uz bytes exceeded by allocation "
+                  "of %uz bytes, %uz bytes are in use",
+                  pool->budget, size, pool->size);
+
+    return NGX_DECLINED;
 }
 
 
 ngx_int_t
 ngx_pfree(ngx_pool_t *pool, void *p)
 {
-    ngx_pool_large_t  *l;
+    ngx_pool_large_t  *l, **ll;
+
+    if (pool->large_hash) {
+        ll = &pool->large_hash[ngx_pool_large_key(p, pool->large_hash_size)];
+
+        for (l = *ll; l; ll = &l->link, l = l->link) {
+            if (p == l->alloc) {
+                *ll = l->link;
+                goto found;
+            }
+        }
+
+        return NGX_DECLINED;
+    }
 
     for (l = pool->large; l; l = l->next) {
         if (p == l->alloc) {
-            ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
-                           "free: %p", l->alloc);
-            ngx_free(l->alloc);
-            l->alloc = NULL;
-
-            return NGX_OK;
+            goto found;
         }
     }
 
     return NGX_DECLINED;
+
+found:
+
+    ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0, "free: %p", l->alloc);
+
+    ngx_free(l->alloc);
+    l->alloc = NULL;
+
+    pool->size -= l->size;
+
+    if (pool->large_free != NGX_POOL_LARGE_PARKED) {
+        l->link = pool->large_free;
+        pool->large_free = l;
+    }
+
+    pool->nlarge--;
+
+    return NGX_OK;
 }
 
 
@@ -333,6 +767,10 @@ ngx_pool_cleanup_add(ngx_pool_t *p, size_t size)
 
     p->cleanup = c;
 
+#if (NGX_STAT_POOL)
+    p->stats.cleanups++;
+#endif
+
     ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, p->log, 0, "add cleanup: %p", c);
 
     return c;
@@ -401,30 +839,343 @@ ngx_pool_delete_file(void *data)
 }
 
 
-#if 0
+void
+ngx_pool_cache_init(ngx_uint_t max)
+{
+    ngx_uint_t                i;
+    ngx_cached_block_t       *block;
+    ngx_cached_block_slot_t  *slot;
+
+    ngx_pool_cache_max = max;
+
+    for (i = 0; i < NGX_POOL_CACHE_SLOTS; i++) {
+        slot = &ngx_pool_cache[i];
+
+        while (slot->number > max) {
+            block = slot->block;
+            slot->block = block->next;
+            slot->number--;
+
+            ngx_free(block);
+        }
+    }
+}
+
+
+static char *
+ngx_pool_set_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_pool_conf_t *pcf = conf;
+
+    ngx_int_t   n;
+    ngx_str_t  *value;
+
+    if (pcf->cache != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        pcf->cache = 0;
+        return NGX_CONF_OK;
+    }
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR) {
+        return "invalid value";
+    }
+
+    pcf->cache = n;
+
+    return NGX_CONF_OK;
+}
+
 
 static void *
-ngx_get_cached_block(size_t size)
+ngx_pool_create_conf(ngx_cycle_t *cycle)
 {
-    void                     *p;
-    ngx_cached_block_slot_t  *slot;
+    ngx_pool_conf_t  *pcf;
 
-    if (ngx_cycle->cache == NULL) {
+    pcf = ngx_pcalloc(cycle->pool, sizeof(ngx_pool_conf_t));
+    if (pcf == NULL) {
         return NULL;
     }
 
-    slot = &ngx_cycle->cache[(size + ngx_pagesize - 1) / ngx_pagesize];
+    pcf->cache = NGX_CONF_UNSET_UINT;
+
+    return pcf;
+}
+
+
+static char *
+ngx_pool_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_pool_conf_t *pcf = conf;
+
+    ngx_conf_init_uint_value(pcf->cache, 0);
+
+    return NGX_CONF_OK;
+}
+
+
+/*
+ * the cache is enabled in the worker processes only, the master process
+ * creates pools only on reconfiguration and need not keep their blocks
+ */
+
+static ngx_int_t
+ngx_pool_init_worker(ngx_cycle_t *cycle)
+{
+    ngx_pool_conf_t  *pcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    pcf = (ngx_pool_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_pool_module);
+
+    ngx_pool_cache_init(pcf->cache);
+
+    return NGX_OK;
+}
+
+
+static size_t
+ngx_pool_block_size(size_t size)
+{
+    /*
+     * the blocks of at least one page are rounded up to a page size
+     * while the cache is enabled, so any block from a slot can be used
+     * for the pool of this size; the rounded tail becomes the pool memory
+     */
+
+    if (ngx_pool_cache_max
+        && size >= ngx_pagesize
+        && size <= NGX_POOL_CACHE_SLOTS * ngx_pagesize)
+    {
+        return ngx_align(size, ngx_pagesize);
+    }
+
+    return size;
+}
+
+
+static void *
+ngx_alloc_block(size_t size, ngx_log_t *log)
+{
+    ngx_cached_block_t       *block;
+    ngx_cached_block_slot_t  *slot;
 
-    slot->tries++;
+    if (ngx_pool_cache_max == 0
+        || size & (ngx_pagesize - 1)
+        || size > NGX_POOL_CACHE_SLOTS * ngx_pagesize)
+    {
+        return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    }
+
+    slot = &ngx_pool_cache[(size >> ngx_pagesize_shift) - 1];
 
     if (slot->number) {
-        p = slot->block;
-        slot->block = slot->block->next;
+        block = slot->block;
+        slot->block = block->next;
         slot->number--;
-        return p;
+        slot->hits++;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, log, 0,
+                       "cached block: %p:%uz", block, size);
+
+        return block;
+    }
+
+    slot->misses++;
+
+    return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+}
+
+
+static void
+ngx_free_block(void *p, size_t size)
+{
+    ngx_cached_block_t       *block;
+    ngx_cached_block_slot_t  *slot;
+
+    if (size & (ngx_pagesize - 1)
+        || size > NGX_POOL_CACHE_SLOTS * ngx_pagesize)
+    {
+        ngx_free(p);
+        return;
+    }
+
+    slot = &ngx_pool_cache[(size >> ngx_pagesize_shift) - 1];
+
+    if (slot->number >= ngx_pool_cache_max) {
+        ngx_free(p);
+        return;
+    }
+
+    block = p;
+    block->next = slot->block;
+    slot->block = block;
+    slot->number++;
+}
+
+
+#if (NGX_STAT_POOL)
+
+void *
+ngx_palloc_site(ngx_pool_t *pool, size_t size, char *file, ngx_uint_t line)
+{
+    ngx_pool_stat_site(file, line, size);
+
+    return ngx_palloc(pool, size);
+}
+
+
+void *
+ngx_pnalloc_site(ngx_pool_t *pool, size_t size, char *file, ngx_uint_t line)
+{
+    ngx_pool_stat_site(file, line, size);
+
+    return ngx_pnalloc(pool, size);
+}
+
+
+void *
+ngx_pcalloc_site(ngx_pool_t *pool, size_t size, char *file, ngx_uint_t line)
+{
+    ngx_pool_stat_site(file, line, size);
+
+    return ngx_pcalloc(pool, size);
+}
+
+
+void *
+ngx_pmemalign_site(ngx_pool_t *pool, size_t size, size_t alignment,
+    char *file, ngx_uint_t line)
+{
+    ngx_pool_stat_site(file, line, size);
+
+    return ngx_pmemalign(pool, size, alignment);
+}
+
+
+static void
+ngx_pool_stat_site(char *file, ngx_uint_t line, size_t size)
+{
+    ngx_uint_t        i, n;
+    ngx_pool_site_t  *site;
+
+    n = ((uintptr_t) file + line * 31) % NGX_POOL_STAT_SITES;
+
+    for (i = 0; i < NGX_POOL_STAT_SITES; i++) {
+        site = &ngx_pool_sites[(n + i) % NGX_POOL_STAT_SITES];
+
+        if (site->file == NULL) {
+            site->file = file;
+            site->line = line;
+
+        } else if (site->file != file || site->line != line) {
+            continue;
+        }
+
+        site->allocs++;
+        site->bytes += size;
+
+        return;
+    }
+
+    /* the table is full, the site is not accounted */
+}
+
+
+void
+ngx_pool_stat_log(ngx_pool_t *pool, ngx_uint_t level, ngx_log_t *log)
+{
+    u_char      *p, failed[NGX_POOL_STAT_FAILED * (NGX_INT_T_LEN + 1) + 1],
+                 large[NGX_POOL_STAT_LARGE * (NGX_INT_T_LEN + 1) + 1];
+    ngx_uint_t   i, n[NGX_POOL_STAT_FAILED];
+    ngx_pool_t  *b;
+
+    ngx_memzero(n, sizeof(n));
+
+    for (b = pool; b; b = b->d.next) {
+        n[ngx_min(b->d.failed, NGX_POOL_STAT_FAILED - 1)]++;
+    }
+
+    p = failed;
+
+    for (i = 0; i < NGX_POOL_STAT_FAILED; i++) {
+        p = ngx_slprintf(p, failed + sizeof(failed) - 1, " %ui", n[i]);
+    }
+
+    *p = '\0';
+
+    p = large;
+
+    for (i = 0; i < NGX_POOL_STAT_LARGE; i++) {
+        p = ngx_slprintf(p, large + sizeof(large) - 1, " %ui",
+                         pool->stats.large[i]);
+    }
+
+    *p = '\0';
+
+    ngx_log_error(level, log, 0,
+                  "pool %p: requested:%uz reserved:%uz allocs:%ui "
+                  "blocks:%ui large:%ui cleanups:%ui failed:%s sizes:%s",
+                  pool, pool->stats.requested, pool->size,
+                  pool->stats.allocs, pool->stats.blocks, pool->nlarge,
+                  pool->stats.cleanups, failed, large);
+}
+
+
+void
+ngx_pool_stat_sites_log(ngx_uint_t n, ngx_uint_t level, ngx_log_t *log)
+{
+    ngx_uint_t        i, k;
+    ngx_pool_site_t  *sites;
+
+    sites = ngx_alloc(sizeof(ngx_pool_sites), log);
+    if (sites == NULL) {
+        return;
+    }
+
+    k = 0;
+
+    for (i = 0; i < NGX_POOL_STAT_SITES; i++) {
+        if (ngx_pool_sites[i].file) {
+            sites[k++] = ngx_pool_sites[i];
+        }
+    }
+
+    ngx_qsort(sites, k, sizeof(ngx_pool_site_t), ngx_pool_cmp_sites);
+
+    for (i = 0; i < k && i < n; i++) {
+        ngx_log_error(level, log, 0, "pool site %s:%ui allocs:%ui bytes:%uz",
+                      sites[i].file, sites[i].line, sites[i].allocs,
+                      sites[i].bytes);
+    }
+
+    ngx_free(sites);
+}
+
+
+static int ngx_libc_cdecl
+ngx_pool_cmp_sites(const void *one, const void *two)
+{
+    ngx_pool_site_t  *first, *second;
+
+    first = (ngx_pool_site_t *) one;
+    second = (ngx_pool_site_t *) two;
+
+    if (first->bytes == second->bytes) {
+        return 0;
     }
 
-    return NULL;
+    return (first->bytes < second->bytes) ? 1 : -1;
 }
 
 #endif
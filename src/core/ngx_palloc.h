@@ -26,9 +26,51 @@
     ngx_align((sizeof(ngx_pool_t) + 2 * sizeof(ngx_pool_large_t)),            \
               NGX_POOL_ALIGNMENT)
 
+/*
+ * the number of slots in the per process cache of free pool blocks,
+ * a slot keeps the blocks of the same size rounded up to a page size,
+ * so the blocks from 1 up to 16 pages are cached
+ */
+#define NGX_POOL_CACHE_SLOTS     16
+
+/*
+ * each next pool block is twice as large as the previous one
+ * up to NGX_MAX_POOL_BLOCK_SIZE, so the block chain stays short
+ */
+#define NGX_MAX_POOL_BLOCK_SIZE  (NGX_POOL_CACHE_SLOTS * ngx_pagesize)
+
+/* a block with less free space is skipped by the small allocations */
+#define NGX_POOL_BLOCK_SLACK     (4 * NGX_ALIGNMENT)
+
+/*
+ * large allocations are indexed by address in a hash once a pool has
+ * more than NGX_POOL_LARGE_HASH of them, so ngx_pfree() does not walk
+ * the list of all large allocations
+ */
+#define NGX_POOL_LARGE_HASH      8
+
+/* the freed large slots are not reused between ngx_pool_mark() and rollback */
+#define NGX_POOL_LARGE_PARKED    (ngx_pool_large_t *) -1
+
+#if (NGX_STAT_POOL)
+
+#define NGX_POOL_STAT_FAILED     8     /* d.failed histogram, 0 .. 7+ */
+#define NGX_POOL_STAT_LARGE      8     /* sizes, < 2, < 4 .. 128+ pages */
+#define NGX_POOL_STAT_SITES      1024
+
+#endif
+
 
 typedef void (*ngx_pool_cleanup_pt)(void *data);
 
+/*
+ * the handler is called when an allocation would exceed the pool budget,
+ * it may raise pool->budget or release memory and return NGX_OK to let
+ * the allocation proceed, otherwise the allocation fails
+ */
+typedef ngx_int_t (*ngx_pool_budget_pt)(ngx_pool_t *pool, size_t size,
+    void *data);
+
 typedef struct ngx_pool_cleanup_s  ngx_pool_cleanup_t;
 
 struct ngx_pool_cleanup_s {
@@ -43,9 +85,32 @@ typedef struct ngx_pool_large_s  ngx_pool_large_t;
 struct ngx_pool_large_s {
     ngx_pool_large_t     *next;
     void                 *alloc;
+    ngx_pool_large_t     *link;     /* hash chain or free slots list */
+    size_t                size;
 };
 
 
+#if (NGX_STAT_POOL)
+
+typedef struct {
+    size_t                requested;
+    ngx_uint_t            allocs;
+    ngx_uint_t            blocks;
+    ngx_uint_t            large[NGX_POOL_STAT_LARGE];
+    ngx_uint_t            cleanups;
+} ngx_pool_stat_t;
+
+
+typedef struct {
+    char                 *file;
+    ngx_uint_t            line;
+    ngx_uint_t            allocs;
+    size_t                bytes;
+} ngx_pool_site_t;
+
+#endif
+
+
 typedef struct {
     u_char               *last;
     u_char               *end;
@@ -57,14 +122,72 @@ typedef struct {
 struct ngx_pool_s {
     ngx_pool_data_t       d;
     size_t                max;
+    size_t                block_size;   /* the next block size */
     ngx_pool_t           *current;
     ngx_chain_t          *chain;
     ngx_pool_large_t     *large;
     ngx_pool_cleanup_t   *cleanup;
     ngx_log_t            *log;
+
+    ngx_pool_large_t     *large_free;
+    ngx_pool_large_t    **large_hash;
+    ngx_uint_t            large_hash_size;
+    ngx_uint_t            nlarge;
+
+    size_t                size;         /* blocks and large allocations */
+    size_t                budget;       /* 0 is unlimited */
+    ngx_pool_budget_pt    budget_handler;
+    void                 *budget_data;
+
+    /*
+     * the block cache is per process and is not locked, so every pool
+     * that may grow in a thread must set nocache before, its new blocks
+     * are then allocated with ngx_memalign(); the pool must still be
+     * reset, rolled back and destroyed in the process's main thread
+     */
+    ngx_uint_t            nocache;
+
+#if (NGX_STAT_POOL)
+    ngx_pool_stat_t       stats;
+#endif
+};
+
+
+/*
+ * the pool state saved by ngx_pool_mark(), ngx_pool_rollback() releases
+ * all allocations and runs all cleanup handlers added after the mark;
+ * the marks must be rolled back in the reverse order
+ */
+
+typedef struct {
+    ngx_pool_t           *current;
+    ngx_pool_t           *last;
+    u_char               *pos;
+    ngx_uint_t            failed;
+    size_t                block_size;
+    ngx_chain_t          *chain;
+    ngx_pool_large_t     *large;
+    ngx_pool_large_t     *large_free;
+    ngx_pool_cleanup_t   *cleanup;
+} ngx_pool_mark_t;
+
+
+typedef struct ngx_cached_block_s  ngx_cached_block_t;
+
+struct ngx_cached_block_s {
+    ngx_cached_block_t   *next;
 };
 
 
+typedef struct {
+    ngx_cached_block_t   *block;
+    ngx_uint_t            number;
+
+    ngx_uint_t            hits;
+    ngx_uint_t            misses;
+} ngx_cached_block_slot_t;
+
+
 typedef struct {
     ngx_fd_t              fd;
     u_char               *name;
@@ -75,6 +198,12 @@ typedef struct {
 ngx_pool_t *ngx_create_pool(size_t size, ngx_log_t *log);
 void ngx_destroy_pool(ngx_pool_t *pool);
 void ngx_reset_pool(ngx_pool_t *pool);
+void ngx_pool_mark(ngx_pool_t *pool, ngx_pool_mark_t *mark);
+void ngx_pool_rollback(ngx_pool_t *pool, ngx_pool_mark_t *mark);
+void ngx_pool_set_budget(ngx_pool_t *pool, size_t budget,
+    ngx_pool_budget_pt handler, void *data);
+
+void ngx_pool_cache_init(ngx_uint_t max);
 
 void *ngx_palloc(ngx_pool_t *pool, size_t size);
 void *ngx_pnalloc(ngx_pool_t *pool, size_t size);
@@ -89,4 +218,35 @@ void ngx_pool_cleanup_file(void *data);
 void ngx_pool_delete_file(void *data);
 
 
+#if (NGX_STAT_POOL)
+
+void ngx_pool_stat_log(ngx_pool_t *pool, ngx_uint_t level, ngx_log_t *log);
+void ngx_pool_stat_sites_log(ngx_uint_t n, ngx_uint_t level, ngx_log_t *log);
+
+/* the allocations are accounted to the call sites */
+
+void *ngx_palloc_site(ngx_pool_t *pool, size_t size, char *file,
+    ngx_uint_t line);
+void *ngx_pnalloc_site(ngx_pool_t *pool, size_t size, char *file,
+    ngx_uint_t line);
+void *ngx_pcalloc_site(ngx_pool_t *pool, size_t size, char *file,
+    ngx_uint_t line);
+void *ngx_pmemalign_site(ngx_pool_t *pool, size_t size, size_t alignment,
+    char *file, ngx_uint_t line);
+
+#define ngx_palloc(pool, size)                                                \
+    ngx_palloc_site(pool, size, __FILE__, __LINE__)
+#define ngx_pnalloc(pool, size)                                               \
+    ngx_pnalloc_site(pool, size, __FILE__, __LINE__)
+#define ngx_pcalloc(pool, size)                                               \
+    ngx_pcalloc_site(pool, size, __FILE__, __LINE__)
+#define ngx_pmemalign(pool, size, alignment)                                  \
+    ngx_pmemalign_site(pool, size, alignment, __FILE__, __LINE__)
+
+#endif
+
+
+extern ngx_cached_block_slot_t  ngx_pool_cache[NGX_POOL_CACHE_SLOTS];
+
+
 #endif /* _NGX_PALLOC_H_INCLUDED_ */
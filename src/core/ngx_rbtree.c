@@ -37,12 +37,19 @@ ngx_rbtree_insert(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
         node->right = sentinel;
         ngx_rbt_black(node);
         *root = node;
+        tree->leftmost = node;
 
         return;
     }
 
     tree->insert(*root, node, sentinel);
 
+    /* a new node is a leaf, it is the minimum if it is left of the minimum */
+
+    if (node == tree->leftmost->left) {
+        tree->leftmost = node;
+    }
+
     /* re-balance tree */
 
     while (node != *root && ngx_rbt_is_red(node->parent)) {
@@ -164,6 +171,21 @@ ngx_rbtree_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
     root = &tree->root;
     sentinel = tree->sentinel;
 
+    if (node == tree->leftmost) {
+
+        /* the leftmost node has no left child, its successor is the next */
+
+        if (node->right != sentinel) {
+            tree->leftmost = ngx_rbtree_min(node->right, sentinel);
+
+        } else if (node != *root) {
+            tree->leftmost = node->parent;
+
+        } else {
+            tree->leftmost = sentinel;
+        }
+    }
+
     if (node->left == sentinel) {
         temp = node->right;
         subst = node;
@@ -38,6 +38,7 @@ struct ngx_rbtree_s {
     ngx_rbtree_node_t     *root;
     ngx_rbtree_node_t     *sentinel;
     ngx_rbtree_insert_pt   insert;
+    ngx_rbtree_node_t     *leftmost;
 };
 
 
@@ -45,7 +46,20 @@ struct ngx_rbtree_s {
     ngx_rbtree_sentinel_init(s);                                              \
     (tree)->root = s;                                                         \
     (tree)->sentinel = s;                                                     \
-    (tree)->insert = i
+    (tree)->insert = i;                                                       \
+    (tree)->leftmost = s
+
+
+/*
+ * the leftmost node is kept by ngx_rbtree_insert() and ngx_rbtree_delete(),
+ * so the minimum is found without a walk from the root; it is the sentinel
+ * if the tree is empty.  The event timers are its intended user:
+ * ngx_event_find_timer() and ngx_event_expire_timers() should take
+ * the earliest timer with ngx_rbtree_leftmost(&ngx_event_timer_rbtree)
+ * instead of ngx_rbtree_min() from the root, see src/misc/ngx_rbtree_bench.c
+ */
+
+#define ngx_rbtree_leftmost(tree)       (tree)->leftmost
 
 
 void ngx_rbtree_insert(ngx_rbtree_t *tree, ngx_rbtree_node_t *node);
@@ -30,7 +30,7 @@
 
 #define NGX_SLAB_PAGE_FREE   0
 #define NGX_SLAB_PAGE_BUSY   0xffffffffffffffff
-#define NGX_SLAB_START       0x8000000000000000
+#define NGX_SLAB_PAGE_START  0x8000000000000000
 
 #define NGX_SLAB_SHIFT_MASK  0x000000000000000f
 #define NGX_SLAB_MAP_MASK    0xffffffff00000000
@@ -40,6 +40,14 @@
 
 #endif
 
+/*
+ * the pages of an intermediate size class have the NGX_SLAB_SMALL type,
+ * the slab keeps the shift of the next power of two, the class flag
+ * and the class number, and the bitmap is placed at the end of the page
+ */
+#define NGX_SLAB_CLASS       0x10
+#define NGX_SLAB_CLASS_SHIFT 5
+
 
 #define ngx_slab_slots(pool)                                                  \
     (ngx_slab_page_t *) ((u_char *) (pool) + sizeof(ngx_slab_pool_t))
@@ -51,7 +59,18 @@
 
 #define ngx_slab_page_addr(pool, page)                                        \
     ((((page) - (pool)->pages) << ngx_pagesize_shift)                         \
-    + (uintptr_t) (pool)->start)
+     + (uintptr_t) (pool)->start)
+
+#define ngx_slab_nslots(pool)                                                 \
+    ((ngx_pagesize_shift - (pool)->min_shift)                                 \
+     * ((pool)->size_classes ? NGX_SLAB_CLASSES + 1 : 1))
+
+#define ngx_slab_class_slot(pool, shift, sc)                                  \
+    (ngx_pagesize_shift - (pool)->min_shift                                   \
+     + NGX_SLAB_CLASSES * ((shift) - (pool)->min_shift) + (sc))
+
+#define ngx_slab_class_map(chunks)                                            \
+    (((chunks) + sizeof(uintptr_t) * 8 - 1) / (sizeof(uintptr_t) * 8))
 
 
 #if (NGX_DEBUG_MALLOC)
@@ -69,6 +88,59 @@
 
 #endif
 
+
+/*
+ * a magazine keeps the chunks of one slot allocated from the pool
+ * by the process, the chunks are moved between the magazine and
+ * the pool by NGX_SLAB_MAGAZINE_BATCH under one lock acquisition;
+ * the deferred frees of the process are released under one lock
+ * acquisition as well
+ */
+
+typedef struct {
+    ngx_uint_t              number;
+    void                   *chunks[NGX_SLAB_MAGAZINE_SIZE];
+} ngx_slab_magazine_t;
+
+
+typedef struct ngx_slab_magazines_s  ngx_slab_magazines_t;
+
+struct ngx_slab_magazines_s {
+    ngx_slab_pool_t        *pool;
+    ngx_slab_magazines_t   *next;
+    ngx_uint_t              nslots;
+    ngx_slab_magazine_t    *magazines;
+
+    ngx_uint_t              ndeferred;
+    ngx_msec_t              deferred_time;   /* of the first deferred free */
+    void                   *deferred[NGX_SLAB_DEFER_SIZE];
+};
+
+
+static void *ngx_slab_alloc_chunk(ngx_slab_pool_t *pool, size_t size);
+static ngx_uint_t ngx_slab_page_chunks(ngx_slab_pool_t *pool,
+    ngx_slab_page_t *page, uintptr_t *chunks, ngx_uint_t *capacity,
+    size_t *size);
+static size_t ngx_slab_chunk_size(ngx_slab_pool_t *pool, size_t size,
+    ngx_uint_t *slot);
+static size_t ngx_slab_size_of(ngx_slab_pool_t *pool, void *p);
+static ngx_int_t ngx_slab_grow_pages(ngx_slab_pool_t *pool,
+    ngx_slab_page_t *page, ngx_uint_t pages);
+static uintptr_t ngx_slab_alloc_class(ngx_slab_pool_t *pool, ngx_uint_t slot,
+    ngx_uint_t shift, ngx_uint_t sc);
+static ngx_inline void ngx_slab_lock(ngx_slab_pool_t *pool);
+static ngx_slab_magazines_t *ngx_slab_get_magazines(ngx_slab_pool_t *pool);
+static void *ngx_slab_magazine_alloc(ngx_slab_pool_t *pool, size_t size);
+static ngx_int_t ngx_slab_magazine_free(ngx_slab_pool_t *pool, void *p);
+static ngx_int_t ngx_slab_defer_free(ngx_slab_pool_t *pool, void *p);
+static void ngx_slab_release_deferred(ngx_slab_pool_t *pool,
+    ngx_slab_magazines_t *mags);
+static void ngx_slab_flush_magazines(ngx_slab_magazines_t *mags);
+static size_t ngx_slab_slot_size(ngx_slab_pool_t *pool, ngx_uint_t slot);
+static ngx_inline ngx_uint_t ngx_slab_free_bin(ngx_uint_t pages);
+static void ngx_slab_free_link(ngx_slab_pool_t *pool, ngx_slab_page_t *page);
+static void ngx_slab_free_unlink(ngx_slab_pool_t *pool,
+    ngx_slab_page_t *page);
 static ngx_slab_page_t *ngx_slab_alloc_pages(ngx_slab_pool_t *pool,
     ngx_uint_t pages);
 static void ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
@@ -76,11 +148,41 @@ static void ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
 static void ngx_slab_error(ngx_slab_pool_t *pool, ngx_uint_t level,
     char *text);
 
+static void ngx_slab_exit_worker(ngx_cycle_t *cycle);
+
+
+static ngx_core_module_t  ngx_slab_module_ctx = {
+    ngx_string("slab"),
+    NULL,
+    NULL
+};
+
+
+ngx_module_t  ngx_slab_module = {
+    NGX_MODULE_V1,
+    &ngx_slab_module_ctx,                  /* module context */
+    NULL,                                  /* module directives */
+    NGX_CORE_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    ngx_slab_exit_worker,                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
 
 static ngx_uint_t  ngx_slab_max_size;
 static ngx_uint_t  ngx_slab_exact_size;
 static ngx_uint_t  ngx_slab_exact_shift;
 
+static size_t      ngx_slab_class_size[16][NGX_SLAB_CLASSES];
+static ngx_uint_t  ngx_slab_class_chunks[16][NGX_SLAB_CLASSES];
+
+static ngx_slab_magazines_t  *ngx_slab_magazines;
+
 
 void
 ngx_slab_init(ngx_slab_pool_t *pool)
@@ -88,7 +190,7 @@ ngx_slab_init(ngx_slab_pool_t *pool)
     u_char           *p;
     size_t            size;
     ngx_int_t         m;
-    ngx_uint_t        i, n, pages;
+    ngx_uint_t        i, n, pages, shift, chunks;
     ngx_slab_page_t  *slots, *page;
 
     /* STUB */
@@ -98,6 +200,35 @@ ngx_slab_init(ngx_slab_pool_t *pool)
         for (n = ngx_slab_exact_size; n >>= 1; ngx_slab_exact_shift++) {
             /* void */
         }
+
+        /*
+         * the intermediate classes start from 64 bytes, so the chunks
+         * are at least 16 bytes aligned; a class is not used if it does
+         * not fit in a page more chunks than the next power of two
+         */
+
+        for (shift = 7; shift < ngx_pagesize_shift; shift++) {
+            for (i = 0; i < NGX_SLAB_CLASSES; i++) {
+                size = ((size_t) 1 << (shift - 1))
+                       + (i + 1) * ((size_t) 1 << (shift - 3));
+
+                chunks = ngx_pagesize / size;
+
+                while (chunks * size
+                       + ngx_slab_class_map(chunks) * sizeof(uintptr_t)
+                       > ngx_pagesize)
+                {
+                    chunks--;
+                }
+
+                if (chunks <= (ngx_pagesize >> shift)) {
+                    continue;
+                }
+
+                ngx_slab_class_size[shift][i] = size;
+                ngx_slab_class_chunks[shift][i] = chunks;
+            }
+        }
     }
     /**/
 
@@ -110,11 +241,11 @@ ngx_slab_init(ngx_slab_pool_t *pool)
 
     ngx_slab_junk(p, size);
 
-    n = ngx_pagesize_shift - pool->min_shift;
+    n = ngx_slab_nslots(pool);
 
     for (i = 0; i < n; i++) {
         /* only "next" is used in list head */
-        slots[i] = 0;
+        slots[i].slab = 0;
         slots[i].next = &slots[i];
         slots[i].prev = 0;
     }
@@ -126,7 +257,21 @@ ngx_slab_init(ngx_slab_pool_t *pool)
 
     p += n * sizeof(ngx_slab_stat_t);
 
-    size -= n * (sizeof(ngx_slab_page_t + sizeof(ngx_slab_stat_t));
+    pool->free = (ngx_slab_page_t *) p;
+
+    for (i = 0; i < NGX_SLAB_FREE_BINS; i++) {
+        /* only "next" is used in list head */
+        pool->free[i].slab = 0;
+        pool->free[i].next = &pool->free[i];
+        pool->free[i].prev = 0;
+    }
+
+    pool->free_map = 0;
+
+    p += NGX_SLAB_FREE_BINS * sizeof(ngx_slab_page_t);
+
+    size -= n * (sizeof(ngx_slab_page_t) + sizeof(ngx_slab_stat_t))
+            + NGX_SLAB_FREE_BINS * sizeof(ngx_slab_page_t);
 
     pages = (ngx_uint_t) (size / (ngx_pagesize + sizeof(ngx_slab_page_t)));
 
@@ -135,27 +280,27 @@ ngx_slab_init(ngx_slab_pool_t *pool)
 
     page = pool->pages;
 
-    /* only "next" is used in list head */
-    pool->free.slab = 0;
-    pool->free.next = page;
-    pool->free.prev = 0;
-
-    page->slab = pages;
-    page->next = &pool->free;
-    page->prev = (uintptr_t) &pool->free;
-
     pool->start = ngx_align_ptr(p + pages * sizeof(ngx_slab_page_t),
                                 ngx_pagesize);
 
     m = pages - (pool->end - pool->start) / ngx_pagesize;
     if (m > 0) {
         pages -= m;
-        page->slab = pages;
     }
 
+    page->slab = pages;
+
+    if (pages > 1) {
+        page[pages - 1].prev = (uintptr_t) page;
+    }
+
+    ngx_slab_free_link(pool, page);
+
     pool->last = pool->pages + pages;
     pool->pfree = pages;
 
+    ngx_memzero(&pool->lock_stats, sizeof(ngx_slab_lock_stat_t));
+
     pool->log_nomem = 1;
     pool->log_ctx = &pool->zero;
     pool->zero = '\0';
@@ -165,14 +310,25 @@ ngx_slab_init(ngx_slab_pool_t *pool)
 void *
 ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 {
-    void  *p;
-    
-    ngx_shmtx_lock(&pool->mutex);
-    
+    void                  *p;
+    ngx_slab_magazines_t  *mags;
+
+    if (pool->magazines && size <= ngx_slab_max_size) {
+        return ngx_slab_magazine_alloc(pool, size);
+    }
+
+    mags = pool->deferred ? ngx_slab_get_magazines(pool) : NULL;
+
+    ngx_slab_lock(pool);
+
+    if (mags && mags->ndeferred) {
+        ngx_slab_release_deferred(pool, mags);
+    }
+
     p = ngx_slab_alloc_locked(pool, size);
-    
+
     ngx_shmtx_unlock(&pool->mutex);
-    
+
     return p;
 }
 
@@ -180,18 +336,52 @@ ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 void *
 ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 {
-    size_t             s;
-    uint_ptr_t         p;
-    ngx_uint_t         i, slot, shift, map;
-    ngx_slab_page_t   *page;
+    void        *p;
+    ngx_uint_t   log_nomem;
+
+    if (pool->pressure == NULL) {
+        return ngx_slab_alloc_chunk(pool, size);
+    }
+
+    log_nomem = pool->log_nomem;
+    pool->log_nomem = 0;
+
+    p = ngx_slab_alloc_chunk(pool, size);
+
+    pool->log_nomem = log_nomem;
+
+    if (p) {
+        return p;
+    }
+
+    if (pool->pressure(pool, size, pool->pressure_data) == NGX_OK) {
+        return ngx_slab_alloc_chunk(pool, size);
+    }
+
+    if (pool->log_nomem) {
+        ngx_slab_error(pool, NGX_LOG_CRIT,
+                       "ngx_slab_alloc() failed: no memory");
+    }
+
+    return NULL;
+}
+
+
+static void *
+ngx_slab_alloc_chunk(ngx_slab_pool_t *pool, size_t size)
+{
+    size_t            s;
+    uintptr_t         p, n, m, mask, *bitmap;
+    ngx_uint_t        i, slot, shift, map, sc;
+    ngx_slab_page_t  *page, *prev, *slots;
 
     if (size > ngx_slab_max_size) {
 
-        ngx_log_debug(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
-                      "slab alloc: %uz", size);
+        ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                       "slab alloc: %uz", size);
 
         page = ngx_slab_alloc_pages(pool, (size >> ngx_pagesize_shift)
-                                          +  ((size % ngx_pagesize) ? 1 : 0));
+                                          + ((size % ngx_pagesize) ? 1 : 0));
         if (page) {
             p = ngx_slab_page_addr(pool, page);
 
@@ -212,12 +402,38 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
         slot = 0;
     }
 
-    pool->stats[slot]->reqs++;
+    if (pool->size_classes && shift > pool->min_shift) {
+
+        for (sc = 0; sc < NGX_SLAB_CLASSES; sc++) {
+            s = ngx_slab_class_size[shift][sc];
+
+            if (s == 0 || size > s) {
+                continue;
+            }
+
+            slot = ngx_slab_class_slot(pool, shift, sc);
+
+            pool->stats[slot].reqs++;
+
+            ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                           "slab alloc: %uz slot: %ui", size, slot);
+
+            p = ngx_slab_alloc_class(pool, slot, shift, sc);
+
+            if (p == 0) {
+                pool->stats[slot].fails++;
+            }
+
+            goto done;
+        }
+    }
+
+    pool->stats[slot].reqs++;
 
     ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
                    "slab alloc: %uz slot: %ui", size, slot);
 
-    slot = ngx_slab_slots(pool);
+    slots = ngx_slab_slots(pool);
     page = slots[slot].next;
 
     if (page->next != page) {
@@ -226,13 +442,13 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
             bitmap = (uintptr_t *) ngx_slab_page_addr(pool, page);
 
-            map = (ngx_pageisze >> shift) / (sizeof(uintptr_t) * 8);
+            map = (ngx_pagesize >> shift) / (sizeof(uintptr_t) * 8);
 
-            for (n = p; n < map; n++) {
+            for (n = 0; n < map; n++) {
 
                 if (bitmap[n] != NGX_SLAB_BUSY) {
 
-                    for (m = 1, i = 0; m; m <<= 1; i++) {
+                    for (m = 1, i = 0; m; m <<= 1, i++) {
                         if (bitmap[n] & m) {
                             continue;
                         }
@@ -243,7 +459,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
                         p = (uintptr_t) bitmap + i;
 
-                        pool->stats[slots].used++;
+                        pool->stats[slot].used++;
 
                         if (bitmap[n] == NGX_SLAB_BUSY) {
                             for (n = n + 1; n < map; n++) {
@@ -278,9 +494,9 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
                     prev = ngx_slab_page_prev(page);
                     prev->next = page->next;
                     page->next->prev = page->prev;
-                    
+
                     page->next = NULL;
-                    page->prev = NGX_SLAB_EXACGT;
+                    page->prev = NGX_SLAB_EXACT;
                 }
 
                 p = ngx_slab_page_addr(pool, page) + (i << shift);
@@ -292,34 +508,34 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
         } else { /* shift > ngx_slab_exact_shift */
 
-           mask = ((uintptr_t) 1 << (ngx_pagesize >> shift)) - 1; 
-           mask <<= NGX_SLAB_MAP_SHIFT;
+            mask = ((uintptr_t) 1 << (ngx_pagesize >> shift)) - 1;
+            mask <<= NGX_SLAB_MAP_SHIFT;
 
-           for (m = (uintptr_t) 1 << NGX_SLAB_MAP_SHIFT, i = 0;
-                m & mask;
-                m << 1, i++)
-           {
-               if (page->slab & m) {
-                   continue;
-               }
+            for (m = (uintptr_t) 1 << NGX_SLAB_MAP_SHIFT, i = 0;
+                 m & mask;
+                 m <<= 1, i++)
+            {
+                if (page->slab & m) {
+                    continue;
+                }
 
-               page->slab |= m;
+                page->slab |= m;
 
-               if ((page->slab & NGX_SLAB_MAP_MASK) == mask) {
-                   prev = ngx_slab_page_prev(page);
-                   prev->next = page->next;
-                   page->next->prev = page->prev;
+                if ((page->slab & NGX_SLAB_MAP_MASK) == mask) {
+                    prev = ngx_slab_page_prev(page);
+                    prev->next = page->next;
+                    page->next->prev = page->prev;
 
-                   page->next = NULL;
-                   page->prev = NGX_SLAB_BIG;
-               }
+                    page->next = NULL;
+                    page->prev = NGX_SLAB_BIG;
+                }
 
-               p = ngx_slab_page_addr(pool, page) + (i << shift);
+                p = ngx_slab_page_addr(pool, page) + (i << shift);
 
-               pool->stats[slot].used++;
+                pool->stats[slot].used++;
 
-               goto done;
-           }
+                goto done;
+            }
         }
 
         ngx_slab_error(pool, NGX_LOG_ALERT, "ngx_slab_alloc(): page is busy");
@@ -365,7 +581,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
             page->slab = 1;
             page->next = &slots[slot];
-            page->prev = (uintptr_t) &slots[slot] | NGX_SLAB_EXACT_SIZE;
+            page->prev = (uintptr_t) &slots[slot] | NGX_SLAB_EXACT;
 
             slots[slot].next = page;
 
@@ -401,7 +617,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
 done:
 
-    ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
+    ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
                    "slab alloc: %p", (void *) p);
 
     return (void *) p;
@@ -413,11 +629,10 @@ ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size)
 {
     void  *p;
 
-    ngx_shmtx_lock(&pool->mutex);
-
-    p = ngx_slab_calloc_locked(pool, size);
-
-    ngx-shmtx_unlock(&pool->mutex);
+    p = ngx_slab_alloc(pool, size);
+    if (p) {
+        ngx_memzero(p, size);
+    }
 
     return p;
 }
@@ -440,7 +655,15 @@ ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size)
 void
 ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 {
-    ngx_shmtx_lock(&pool->mutex);
+    if (pool->magazines && ngx_slab_magazine_free(pool, p) == NGX_OK) {
+        return;
+    }
+
+    if (pool->deferred && ngx_slab_defer_free(pool, p) == NGX_OK) {
+        return;
+    }
+
+    ngx_slab_lock(pool);
 
     ngx_slab_free_locked(pool, p);
 
@@ -453,7 +676,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 {
     size_t            size;
     uintptr_t         slab, m, *bitmap;
-    ngx_uint_t        i, n, type, slot, shift, map;
+    ngx_uint_t        i, n, type, slot, shift, map, sc, chunks;
     ngx_slab_page_t  *slots, *page;
 
     ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0, "slab free: %p", p);
@@ -466,13 +689,18 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
     n = ((u_char *) p - pool->start) >> ngx_pagesize_shift;
     page = &pool->pages[n];
     slab = page->slab;
-    type = ngx_slab_pate_type(page);
+    type = ngx_slab_page_type(page);
 
     switch (type) {
 
     case NGX_SLAB_SMALL:
 
         shift = slab & NGX_SLAB_SHIFT_MASK;
+
+        if (slab & NGX_SLAB_CLASS) {
+            goto size_class;
+        }
+
         size = (size_t) 1 << shift;
 
         if ((uintptr_t) p & (size - 1)) {
@@ -482,152 +710,1516 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
         n = ((uintptr_t) p & (ngx_pagesize - 1)) >> shift;
         m = (uintptr_t) 1 << (n % (sizeof(uintptr_t) * 8));
         n /= sizeof(uintptr_t) * 8;
-        bitmap = (uintptr_t)
+        bitmap = (uintptr_t *)
                              ((uintptr_t) p & ~((uintptr_t) ngx_pagesize - 1));
 
         if (bitmap[n] & m) {
             slot = shift - pool->min_shift;
 
-            if (page->next = NULL) {
+            if (page->next == NULL) {
+                slots = ngx_slab_slots(pool);
 
+                page->next = slots[slot].next;
+                slots[slot].next = page;
 
+                page->prev = (uintptr_t) &slots[slot] | NGX_SLAB_SMALL;
+                page->next->prev = (uintptr_t) page | NGX_SLAB_SMALL;
+            }
 
+            bitmap[n] &= ~m;
 
+            n = (ngx_pagesize >> shift) / ((1 << shift) * 8);
 
+            if (n == 0) {
+                n = 1;
+            }
 
-static ngx_slab_page_t *
-ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
-{
-    ngx_slab_page_t   *page, *p;
+            if (bitmap[0] & ~(((uintptr_t) 1 << n) - 1)) {
+                goto done;
+            }
+
+            map = (ngx_pagesize >> shift) / (sizeof(uintptr_t) * 8);
+
+            for (i = 1; i < map; i++) {
+                if (bitmap[i]) {
+                    goto done;
+                }
+            }
+
+            ngx_slab_free_pages(pool, page, 1);
+
+            pool->stats[slot].total -= (ngx_pagesize >> shift) - n;
+
+            goto done;
+        }
+
+        goto chunk_already_free;
+
+    case NGX_SLAB_EXACT:
+
+        m = (uintptr_t) 1 <<
+                (((uintptr_t) p & (ngx_pagesize - 1)) >> ngx_slab_exact_shift);
+        size = ngx_slab_exact_size;
 
-    for (page = pool->free.next; page != &pool->free; page = page->next) {
+        if ((uintptr_t) p & (size - 1)) {
+            goto wrong_chunk;
+        }
+
+        if (slab & m) {
+            slot = ngx_slab_exact_shift - pool->min_shift;
 
-        if (page->slab >= pages) {
+            if (slab == NGX_SLAB_BUSY) {
+                slots = ngx_slab_slots(pool);
 
-            if (page->slab > pages) {
-                page[page->slab - 1].prev = (uintptr_t) &page[pages];
+                page->next = slots[slot].next;
+                slots[slot].next = page;
 
-                page[pages].slab = page->slab - pages;
-                page[pages].next = page->next;
-                page[pages].prev = page->prev;
+                page->prev = (uintptr_t) &slots[slot] | NGX_SLAB_EXACT;
+                page->next->prev = (uintptr_t) page | NGX_SLAB_EXACT;
+            }
 
-                p = (ngx_slab_page_t *) page->prev;
-                p->next = &page[pages];
-                page->next->prev = (uintptr_t) &page[pages];
+            page->slab &= ~m;
 
-            } else {
-                p = (ngx_slab_page_t *) page->prev;
-                p->next = page->next;
-                page->next->prev = p->prev;
+            if (page->slab) {
+                goto done;
             }
 
-            page->slab = pages | NGX_SLAB_PAGE_START;
-            page->next = NULL;
-            page->prev = NGX_SLAB_PAGE;
+            ngx_slab_free_pages(pool, page, 1);
+
+            pool->stats[slot].total -= sizeof(uintptr_t) * 8;
+
+            goto done;
+        }
+
+        goto chunk_already_free;
+
+    case NGX_SLAB_BIG:
+
+        shift = slab & NGX_SLAB_SHIFT_MASK;
+        size = (size_t) 1 << shift;
 
-            pool->pfree -= pages;
+        if ((uintptr_t) p & (size - 1)) {
+            goto wrong_chunk;
+        }
+
+        m = (uintptr_t) 1 << ((((uintptr_t) p & (ngx_pagesize - 1)) >> shift)
+                              + NGX_SLAB_MAP_SHIFT);
+
+        if (slab & m) {
+            slot = shift - pool->min_shift;
+
+            if (page->next == NULL) {
+                slots = ngx_slab_slots(pool);
+
+                page->next = slots[slot].next;
+                slots[slot].next = page;
 
-            if (--pages) {
-                return page;
+                page->prev = (uintptr_t) &slots[slot] | NGX_SLAB_BIG;
+                page->next->prev = (uintptr_t) page | NGX_SLAB_BIG;
             }
 
-            for (p = page + 1; pages; pages--) {
-                p->slab = NGX_SLAB_PAGE_BUSY;
-                p->next = NULL;
-                p->prev = NGX_SLAB_PAGE;
-                p++;
+            page->slab &= ~m;
+
+            if (page->slab & NGX_SLAB_MAP_MASK) {
+                goto done;
             }
 
-            return page;
+            ngx_slab_free_pages(pool, page, 1);
+
+            pool->stats[slot].total -= ngx_pagesize >> shift;
+
+            goto done;
         }
-    }
 
-    if (pool->log_nomem) {
-        ngx_slab_error(pool, NGX_LOG_CRIT,
-                       "ngx_slab_alloc() failed: no memory");
-    }
+        goto chunk_already_free;
 
-    return NULL;
-}
+    case NGX_SLAB_PAGE:
 
+        if ((uintptr_t) p & (ngx_pagesize - 1)) {
+            goto wrong_chunk;
+        }
 
-static void
-ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
-    ngx_uint_t pages)
-{
-    ngx_slab_page_t  *prev, *join;
+        if (!(slab & NGX_SLAB_PAGE_START)) {
+            ngx_slab_error(pool, NGX_LOG_ALERT,
+                           "ngx_slab_free(): page is already free");
+            goto fail;
+        }
 
-    pool->pfree = pages;
+        if (slab == NGX_SLAB_PAGE_BUSY) {
+            ngx_slab_error(pool, NGX_LOG_ALERT,
+                           "ngx_slab_free(): pointer to wrong page");
+            goto fail;
+        }
 
-    page->slab = pages--;
+        n = ((u_char *) p - pool->start) >> ngx_pagesize_shift;
+        size = slab & ~NGX_SLAB_PAGE_START;
 
-    if (pages) {
-        ngx_memzero(&page[1], pages * sizeof(ngx_slab_page_t));
-    }
+        ngx_slab_free_pages(pool, &pool->pages[n], size);
 
-    if (page->next) {
-        prev = ngx_slab_page_prev(page);
-        prev->next = page->next;
-        page->next->prev = page->prev;
+        ngx_slab_junk(p, size << ngx_pagesize_shift);
+
+        return;
     }
 
-    join = page + page->slab;
+    /* not reached */
 
-    if (join < pool->last) {
+    return;
 
-        if (ngx_slab_page_type(join) == NGX_SLAB_PAGE) {
+size_class:
 
-            if (join->next != NULL) {
-                pages += join->slab;
-                page->slab += join->slab;
+    sc = slab >> NGX_SLAB_CLASS_SHIFT;
+    size = ngx_slab_class_size[shift][sc];
+    chunks = ngx_slab_class_chunks[shift][sc];
 
-                prev = ngx_slab_page_prev(join);
-                prev->next = join->next;
-                join->next->prev = join->prev;
+    n = (uintptr_t) p & (ngx_pagesize - 1);
 
-                join->slab = NGX_SLAB_PAGE_FREE;
-                join->next = NULL;
-                join->prev = NGX_SLAB_PAGE;
-            }
-        }
+    if (n % size || n / size >= chunks) {
+        goto wrong_chunk;
     }
 
-    if (page > pool->pages) {
-        join = page - 1;
+    n /= size;
+    m = (uintptr_t) 1 << (n % (sizeof(uintptr_t) * 8));
+    n /= sizeof(uintptr_t) * 8;
 
-        if (ngx_slab_page_type(join) == NGX_SLAB_PAGE) {
+    map = ngx_slab_class_map(chunks);
+    bitmap = (uintptr_t *) (((uintptr_t) p & ~((uintptr_t) ngx_pagesize - 1))
+                            + ngx_pagesize) - map;
 
-            if (join->slab == NGX_SLAB_PAGE_FREE) {
-                join = ngx_slab_page_prev(join);
-            }
+    if (!(bitmap[n] & m)) {
+        goto chunk_already_free;
+    }
 
-            if (join->next != NULL) {
-                pages += join->slab;
-                join->slab += page->slab;
+    slot = ngx_slab_class_slot(pool, shift, sc);
 
-                prev = ngx_slab_page_prev(join);
-                prev->next = join->next;
-                join->next->prev = join->prev;
+    if (page->next == NULL) {
+        slots = ngx_slab_slots(pool);
 
-                page->slab = NGX_SLAB_PAGE_FREE;
-                page->next = NULL;
-                page->prev = NGX_SLAB_PAGE;
+        page->next = slots[slot].next;
+        slots[slot].next = page;
 
-                page = join;
-            }
+        page->prev = (uintptr_t) &slots[slot] | NGX_SLAB_SMALL;
+        page->next->prev = (uintptr_t) page | NGX_SLAB_SMALL;
+    }
+
+    bitmap[n] &= ~m;
+
+    /* the bits after the last chunk are always set */
+
+    for (i = 0; i < map - 1; i++) {
+        if (bitmap[i]) {
+            goto done;
         }
     }
 
-    if (pages) {
-        page[pages].prev = (uintptr_t) page;
+    n = chunks % (sizeof(uintptr_t) * 8);
+    m = n ? ((uintptr_t) 1 << n) - 1 : NGX_SLAB_BUSY;
+
+    if (bitmap[i] & m) {
+        goto done;
     }
 
-    page->prev = (uintptr_t) &pool->free;
-    page->next = pool->free->next;
+    ngx_slab_free_pages(pool, page, 1);
 
-    page->next->prev = (uintptr_t) page;
+    pool->stats[slot].total -= chunks;
+
+done:
+
+    pool->stats[slot].used--;
+
+    ngx_slab_junk(p, size);
+
+    return;
+
+wrong_chunk:
+
+    ngx_slab_error(pool, NGX_LOG_ALERT,
+                   "ngx_slab_free(): pointer to wrong chunk");
+
+    goto fail;
+
+chunk_already_free:
+
+    ngx_slab_error(pool, NGX_LOG_ALERT,
+                   "ngx_slab_free(): chunk is already free");
+
+fail:
+
+    return;
+}
+
+
+void *
+ngx_slab_realloc(ngx_slab_pool_t *pool, void *p, size_t size)
+{
+    void  *new;
+
+    ngx_slab_lock(pool);
+
+    new = ngx_slab_realloc_locked(pool, p, size);
+
+    ngx_shmtx_unlock(&pool->mutex);
+
+    return new;
+}
+
+
+/*
+ * a chunk is kept if the new size fits in it, and a page run is grown
+ * in place if the pages after it are free; otherwise the data are moved,
+ * and the old memory stays allocated if the new one cannot be allocated
+ */
+
+void *
+ngx_slab_realloc_locked(ngx_slab_pool_t *pool, void *p, size_t size)
+{
+    void             *new;
+    size_t            old;
+    ngx_uint_t        n, pages;
+    ngx_slab_page_t  *page;
+
+    if (p == NULL) {
+        return ngx_slab_alloc_locked(pool, size);
+    }
+
+    old = ngx_slab_size_of(pool, p);
+
+    if (old == 0) {
+        return NULL;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                   "slab realloc: %p:%uz to %uz", p, old, size);
+
+    if (size <= old) {
+        return p;
+    }
+
+    if (old >= ngx_pagesize) {
+        n = ((u_char *) p - pool->start) >> ngx_pagesize_shift;
+        page = &pool->pages[n];
+
+        pages = (size >> ngx_pagesize_shift)
+                + ((size % ngx_pagesize) ? 1 : 0);
+
+        if (ngx_slab_grow_pages(pool, page, pages) == NGX_OK) {
+            return p;
+        }
+    }
+
+    /*
+     * the pressure handler is not called, as it may free the old memory
+     * before it is copied
+     */
+
+    new = ngx_slab_alloc_chunk(pool, size);
+    if (new == NULL) {
+        return NULL;
+    }
+
+    ngx_memcpy(new, p, old);
+
+    ngx_slab_free_locked(pool, p);
+
+    return new;
+}
+
+
+ngx_uint_t
+ngx_slab_compact(ngx_slab_pool_t *pool, ngx_slab_relocate_pt relocate,
+    void *data)
+{
+    ngx_uint_t  n;
+
+    ngx_slab_lock(pool);
+
+    n = ngx_slab_compact_locked(pool, relocate, data);
+
+    ngx_shmtx_unlock(&pool->mutex);
+
+    return n;
+}
+
+
+/*
+ * the live chunks of sparsely used pages are moved to other pages of
+ * the same slot, so the pages become free; the number of freed pages
+ * is returned
+ */
+
+ngx_uint_t
+ngx_slab_compact_locked(ngx_slab_pool_t *pool, ngx_slab_relocate_pt relocate,
+    void *data)
+{
+    size_t            size;
+    uintptr_t         chunks[NGX_SLAB_COMPACT_CHUNKS],
+                      moved[NGX_SLAB_COMPACT_CHUNKS];
+    ngx_uint_t        i, k, n, slot, nslots, npages, type, used, capacity,
+                      freed;
+    ngx_slab_page_t  *slots, *page, *prev, *pages[NGX_SLAB_COMPACT_PAGES];
+
+    if (pool->magazines || pool->deferred) {
+        /*
+         * the chunks kept in the magazines or deferred by other processes
+         * look used
+         */
+        return 0;
+    }
+
+    slots = ngx_slab_slots(pool);
+    nslots = ngx_slab_nslots(pool);
+
+    freed = 0;
+
+    for (slot = 0; slot < nslots; slot++) {
+
+        /*
+         * the candidate pages are collected first, as the slot list
+         * is changed by the allocations and frees below
+         */
+
+        npages = 0;
+
+        for (page = slots[slot].next;
+             page != &slots[slot] && npages < NGX_SLAB_COMPACT_PAGES;
+             page = page->next)
+        {
+            used = ngx_slab_page_chunks(pool, page, NULL, &capacity, &size);
+
+            if (used <= NGX_SLAB_COMPACT_CHUNKS && used * 4 <= capacity) {
+                pages[npages++] = page;
+            }
+        }
+
+        for (n = 0; n < npages; n++) {
+            page = pages[n];
+            type = ngx_slab_page_type(page);
+
+            if (type == NGX_SLAB_PAGE || page->next == NULL) {
+                /* the page was freed or filled by the previous moves */
+                continue;
+            }
+
+            used = ngx_slab_page_chunks(pool, page, chunks, &capacity, &size);
+
+            if (used > NGX_SLAB_COMPACT_CHUNKS || used * 4 > capacity) {
+                continue;
+            }
+
+            /* the page is taken out of the list, so it is not allocated */
+
+            prev = ngx_slab_page_prev(page);
+            prev->next = page->next;
+            page->next->prev = page->prev;
+
+            page->next = NULL;
+            page->prev = type;
+
+            if (slots[slot].next == &slots[slot]) {
+                /* there are no other pages with free chunks in the slot */
+                goto relink;
+            }
+
+            for (k = 0; k < used; k++) {
+                moved[k] = (uintptr_t) ngx_slab_alloc_chunk(pool, size);
+
+                if (moved[k] == 0) {
+                    break;
+                }
+            }
+
+            for (i = 0; i < k; i++) {
+                ngx_memcpy((void *) moved[i], (void *) chunks[i], size);
+
+                if (relocate((void *) chunks[i], (void *) moved[i], size, data)
+                    == NGX_OK)
+                {
+                    ngx_slab_free_locked(pool, (void *) chunks[i]);
+
+                } else {
+                    ngx_slab_free_locked(pool, (void *) moved[i]);
+                }
+            }
+
+            if (ngx_slab_page_type(page) == NGX_SLAB_PAGE) {
+                freed++;
+                continue;
+            }
+
+            if (page->next) {
+                /* linked back by a free */
+                continue;
+            }
+
+        relink:
+
+            page->next = slots[slot].next;
+            slots[slot].next = page;
+
+            page->prev = (uintptr_t) &slots[slot] | type;
+            page->next->prev = (uintptr_t) page | type;
+        }
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                   "slab compact: %ui pages freed", freed);
+
+    return freed;
+}
+
+
+/*
+ * the addresses of the used chunks are stored in "chunks" if it is set,
+ * the number of the used chunks is returned, or NGX_SLAB_COMPACT_CHUNKS + 1
+ * if there are more of them
+ */
+
+static ngx_uint_t
+ngx_slab_page_chunks(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
+    uintptr_t *chunks, ngx_uint_t *capacity, size_t *size)
+{
+    uintptr_t   slab, addr, *bitmap;
+    ngx_uint_t  i, n, first, used, shift, sc;
+
+    slab = page->slab;
+    addr = ngx_slab_page_addr(pool, page);
+
+    used = 0;
+
+    switch (ngx_slab_page_type(page)) {
+
+    case NGX_SLAB_SMALL:
+
+        shift = slab & NGX_SLAB_SHIFT_MASK;
+
+        if (slab & NGX_SLAB_CLASS) {
+            sc = slab >> NGX_SLAB_CLASS_SHIFT;
+
+            *size = ngx_slab_class_size[shift][sc];
+            n = ngx_slab_class_chunks[shift][sc];
+
+            bitmap = (uintptr_t *) (addr + ngx_pagesize)
+                     - ngx_slab_class_map(n);
+            first = 0;
+
+        } else {
+            *size = (size_t) 1 << shift;
+            n = ngx_pagesize >> shift;
+
+            bitmap = (uintptr_t *) addr;
+
+            first = n / ((1 << shift) * 8);
+
+            if (first == 0) {
+                first = 1;
+            }
+        }
+
+        *capacity = n - first;
+
+        for (i = first; i < n; i++) {
+            if (bitmap[i / (sizeof(uintptr_t) * 8)]
+                & ((uintptr_t) 1 << (i % (sizeof(uintptr_t) * 8))))
+            {
+                if (used == NGX_SLAB_COMPACT_CHUNKS) {
+                    return used + 1;
+                }
+
+                if (chunks) {
+                    chunks[used] = addr + i * *size;
+                }
+
+                used++;
+            }
+        }
+
+        return used;
+
+    case NGX_SLAB_EXACT:
+
+        *size = ngx_slab_exact_size;
+        n = sizeof(uintptr_t) * 8;
+        shift = 0;
+        break;
+
+    case NGX_SLAB_BIG:
+
+        shift = slab & NGX_SLAB_SHIFT_MASK;
+        *size = (size_t) 1 << shift;
+        n = ngx_pagesize >> shift;
+        shift = NGX_SLAB_MAP_SHIFT;
+        break;
+
+    default: /* NGX_SLAB_PAGE */
+        *capacity = 0;
+        return NGX_SLAB_COMPACT_CHUNKS + 1;
+    }
+
+    *capacity = n;
+
+    for (i = 0; i < n; i++) {
+        if (slab & ((uintptr_t) 1 << (i + shift))) {
+            if (used == NGX_SLAB_COMPACT_CHUNKS) {
+                return used + 1;
+            }
+
+            if (chunks) {
+                chunks[used] = addr + i * *size;
+            }
+
+            used++;
+        }
+    }
+
+    return used;
+}
+
+
+static size_t
+ngx_slab_size_of(ngx_slab_pool_t *pool, void *p)
+{
+    uintptr_t         slab;
+    ngx_uint_t        n, shift;
+    ngx_slab_page_t  *page;
+
+    if ((u_char *) p < pool->start || (u_char *) p >= pool->end) {
+        ngx_slab_error(pool, NGX_LOG_ALERT,
+                       "ngx_slab_realloc(): outside of pool");
+        return 0;
+    }
+
+    n = ((u_char *) p - pool->start) >> ngx_pagesize_shift;
+    page = &pool->pages[n];
+    slab = page->slab;
+
+    switch (ngx_slab_page_type(page)) {
+
+    case NGX_SLAB_SMALL:
+
+        shift = slab & NGX_SLAB_SHIFT_MASK;
+
+        if (slab & NGX_SLAB_CLASS) {
+            return ngx_slab_class_size[shift][slab >> NGX_SLAB_CLASS_SHIFT];
+        }
+
+        return (size_t) 1 << shift;
+
+    case NGX_SLAB_EXACT:
+        return ngx_slab_exact_size;
+
+    case NGX_SLAB_BIG:
+        return (size_t) 1 << (slab & NGX_SLAB_SHIFT_MASK);
+
+    default: /* NGX_SLAB_PAGE */
+
+        if (!(slab & NGX_SLAB_PAGE_START) || slab == NGX_SLAB_PAGE_BUSY
+            || ((uintptr_t) p & (ngx_pagesize - 1)))
+        {
+            ngx_slab_error(pool, NGX_LOG_ALERT,
+                           "ngx_slab_realloc(): pointer to wrong page");
+            return 0;
+        }
+
+        return (slab & ~NGX_SLAB_PAGE_START) << ngx_pagesize_shift;
+    }
+}
+
+
+static ngx_int_t
+ngx_slab_grow_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
+    ngx_uint_t pages)
+{
+    ngx_uint_t        n, need;
+    ngx_slab_page_t  *join, *p;
+
+    n = page->slab & ~NGX_SLAB_PAGE_START;
+    need = pages - n;
+
+    join = page + n;
+
+    if (join >= pool->last
+        || ngx_slab_page_type(join) != NGX_SLAB_PAGE
+        || join->next == NULL
+        || join->slab < need)
+    {
+        return NGX_DECLINED;
+    }
+
+    ngx_slab_free_unlink(pool, join);
+
+    if (join->slab > need) {
+        p = &join[need];
+
+        p->slab = join->slab - need;
+
+        if (p->slab > 1) {
+            p[p->slab - 1].prev = (uintptr_t) p;
+        }
+
+        ngx_slab_free_link(pool, p);
+    }
+
+    for (p = join; p < join + need; p++) {
+        p->slab = NGX_SLAB_PAGE_BUSY;
+        p->next = NULL;
+        p->prev = NGX_SLAB_PAGE;
+    }
+
+    page->slab = pages | NGX_SLAB_PAGE_START;
+
+    pool->pfree -= need;
+
+    return NGX_OK;
+}
+
+
+static uintptr_t
+ngx_slab_alloc_class(ngx_slab_pool_t *pool, ngx_uint_t slot, ngx_uint_t shift,
+    ngx_uint_t sc)
+{
+    size_t            size;
+    uintptr_t         p, m, *bitmap;
+    ngx_uint_t        i, n, map, chunks;
+    ngx_slab_page_t  *page, *prev, *slots;
+
+    size = ngx_slab_class_size[shift][sc];
+    chunks = ngx_slab_class_chunks[shift][sc];
+    map = ngx_slab_class_map(chunks);
+
+    slots = ngx_slab_slots(pool);
+    page = slots[slot].next;
+
+    if (page->next != page) {
+
+        bitmap = (uintptr_t *) (ngx_slab_page_addr(pool, page)
+                                + ngx_pagesize) - map;
+
+        for (n = 0; n < map; n++) {
+
+            if (bitmap[n] == NGX_SLAB_BUSY) {
+                continue;
+            }
+
+            for (m = 1, i = 0; bitmap[n] & m; m <<= 1, i++) { /* void */ }
+
+            bitmap[n] |= m;
+
+            i += n * sizeof(uintptr_t) * 8;
+            p = ngx_slab_page_addr(pool, page) + i * size;
+
+            pool->stats[slot].used++;
+
+            if (bitmap[n] == NGX_SLAB_BUSY) {
+                for (n = n + 1; n < map; n++) {
+                    if (bitmap[n] != NGX_SLAB_BUSY) {
+                        return p;
+                    }
+                }
+
+                prev = ngx_slab_page_prev(page);
+                prev->next = page->next;
+                page->next->prev = page->prev;
+
+                page->next = NULL;
+                page->prev = NGX_SLAB_SMALL;
+            }
+
+            return p;
+        }
+
+        ngx_slab_error(pool, NGX_LOG_ALERT, "ngx_slab_alloc(): page is busy");
+        ngx_debug_point();
+    }
+
+    page = ngx_slab_alloc_pages(pool, 1);
+
+    if (page == NULL) {
+        return 0;
+    }
+
+    bitmap = (uintptr_t *) (ngx_slab_page_addr(pool, page) + ngx_pagesize)
+             - map;
+
+    /* the bits after the last chunk are set, plus one requested */
+
+    for (i = 0; i < map; i++) {
+        bitmap[i] = 0;
+    }
+
+    n = chunks % (sizeof(uintptr_t) * 8);
+
+    if (n) {
+        bitmap[map - 1] = ~(((uintptr_t) 1 << n) - 1);
+    }
+
+    bitmap[0] |= 1;
+
+    page->slab = shift | NGX_SLAB_CLASS | (sc << NGX_SLAB_CLASS_SHIFT);
+    page->next = &slots[slot];
+    page->prev = (uintptr_t) &slots[slot] | NGX_SLAB_SMALL;
+
+    slots[slot].next = page;
+
+    pool->stats[slot].total += chunks;
+    pool->stats[slot].used++;
+
+    return ngx_slab_page_addr(pool, page);
+}
+
+
+static size_t
+ngx_slab_chunk_size(ngx_slab_pool_t *pool, size_t size, ngx_uint_t *slot)
+{
+    size_t      s;
+    ngx_uint_t  sc, shift;
+
+    if (size <= pool->min_size) {
+        *slot = 0;
+        return pool->min_size;
+    }
+
+    shift = 1;
+    for (s = size - 1; s >>= 1; shift++) { /* void */ }
+
+    if (pool->size_classes) {
+        for (sc = 0; sc < NGX_SLAB_CLASSES; sc++) {
+            s = ngx_slab_class_size[shift][sc];
+
+            if (s && size <= s) {
+                *slot = ngx_slab_class_slot(pool, shift, sc);
+                return s;
+            }
+        }
+    }
+
+    *slot = shift - pool->min_shift;
+
+    return (size_t) 1 << shift;
+}
+
+
+static ngx_inline void
+ngx_slab_lock(ngx_slab_pool_t *pool)
+{
+    time_t          sec;
+    ngx_uint_t      usec;
+    struct timeval  tv;
+
+    /* the counters are updated under the lock */
+
+    if (ngx_shmtx_trylock(&pool->mutex)) {
+        pool->lock_stats.locks++;
+        return;
+    }
+
+    /* the time is only taken if the lock is busy */
+
+    ngx_gettimeofday(&tv);
+
+    sec = tv.tv_sec;
+    usec = tv.tv_usec;
+
+    ngx_shmtx_lock(&pool->mutex);
+
+    ngx_gettimeofday(&tv);
+
+    pool->lock_stats.locks++;
+    pool->lock_stats.waits++;
+    pool->lock_stats.wait_time += (tv.tv_sec - sec) * 1000000
+                                  + tv.tv_usec - usec;
+}
+
+
+/*
+ * the magazines are kept in the process memory, the chunks in them are
+ * allocated from the pool's point of view; the master process does not
+ * use them, as the chunks would be inherited by all workers; a worker
+ * returns them on exit, so only a killed worker loses its magazines,
+ * that is up to NGX_SLAB_MAGAZINE_SIZE chunks of each slot
+ */
+
+static ngx_slab_magazines_t *
+ngx_slab_get_magazines(ngx_slab_pool_t *pool)
+{
+    size_t                 size;
+    ngx_uint_t             n;
+    ngx_slab_magazines_t  *mags;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NULL;
+    }
+
+    for (mags = ngx_slab_magazines; mags; mags = mags->next) {
+        if (mags->pool == pool) {
+            return mags;
+        }
+    }
+
+    n = ngx_slab_nslots(pool);
+    size = sizeof(ngx_slab_magazines_t) + n * sizeof(ngx_slab_magazine_t);
+
+    mags = ngx_alloc(size, ngx_cycle->log);
+    if (mags == NULL) {
+        return NULL;
+    }
+
+    ngx_memzero(mags, size);
+
+    mags->pool = pool;
+    mags->nslots = n;
+    mags->magazines = (ngx_slab_magazine_t *) &mags[1];
+
+    mags->next = ngx_slab_magazines;
+    ngx_slab_magazines = mags;
+
+    return mags;
+}
+
+
+static void *
+ngx_slab_magazine_alloc(ngx_slab_pool_t *pool, size_t size)
+{
+    void                  *p;
+    size_t                 s;
+    ngx_uint_t             i, slot, log_nomem;
+    ngx_slab_magazine_t   *mag;
+    ngx_slab_magazines_t  *mags;
+
+    s = ngx_slab_chunk_size(pool, size, &slot);
+
+    mags = ngx_slab_get_magazines(pool);
+
+    if (mags == NULL) {
+        ngx_slab_lock(pool);
+        p = ngx_slab_alloc_locked(pool, size);
+        ngx_shmtx_unlock(&pool->mutex);
+
+        return p;
+    }
+
+    mag = &mags->magazines[slot];
+
+    if (mag->number) {
+        return mag->chunks[--mag->number];
+    }
+
+    /* refill the magazine, the chunks are allocated by the chunk size */
+
+    ngx_slab_lock(pool);
+
+    pool->lock_stats.refills++;
+
+    if (mags->ndeferred) {
+        ngx_slab_release_deferred(pool, mags);
+    }
+
+    p = ngx_slab_alloc_locked(pool, s);
+
+    if (p) {
+        log_nomem = pool->log_nomem;
+        pool->log_nomem = 0;
+
+        for (i = 1; i < NGX_SLAB_MAGAZINE_BATCH; i++) {
+            mag->chunks[mag->number] = ngx_slab_alloc_chunk(pool, s);
+            if (mag->chunks[mag->number] == NULL) {
+                break;
+            }
+
+            mag->number++;
+        }
+
+        pool->log_nomem = log_nomem;
+    }
+
+    ngx_shmtx_unlock(&pool->mutex);
+
+    return p;
+}
+
+
+static ngx_int_t
+ngx_slab_magazine_free(ngx_slab_pool_t *pool, void *p)
+{
+    size_t                 size;
+    uintptr_t              slab;
+    ngx_uint_t             i, n, sc, slot, type, shift;
+    ngx_slab_page_t       *page;
+    ngx_slab_magazine_t   *mag;
+    ngx_slab_magazines_t  *mags;
+
+    if ((u_char *) p < pool->start || (u_char *) p >= pool->end) {
+        return NGX_DECLINED;
+    }
+
+    /*
+     * the type and the shift of the page do not change while the chunk
+     * is allocated, so they are read without the lock
+     */
+
+    n = ((u_char *) p - pool->start) >> ngx_pagesize_shift;
+    page = &pool->pages[n];
+    slab = page->slab;
+    type = ngx_slab_page_type(page);
+
+    switch (type) {
+
+    case NGX_SLAB_SMALL:
+    case NGX_SLAB_BIG:
+        shift = slab & NGX_SLAB_SHIFT_MASK;
+        break;
+
+    case NGX_SLAB_EXACT:
+        shift = ngx_slab_exact_shift;
+        break;
+
+    default: /* NGX_SLAB_PAGE */
+        return NGX_DECLINED;
+    }
+
+    if (type == NGX_SLAB_SMALL && (slab & NGX_SLAB_CLASS)) {
+        sc = slab >> NGX_SLAB_CLASS_SHIFT;
+        size = ngx_slab_class_size[shift][sc];
+        slot = ngx_slab_class_slot(pool, shift, sc);
+
+        if (((uintptr_t) p & (ngx_pagesize - 1)) % size) {
+            return NGX_DECLINED;
+        }
+
+    } else {
+        size = (size_t) 1 << shift;
+        slot = shift - pool->min_shift;
+
+        if ((uintptr_t) p & (size - 1)) {
+            return NGX_DECLINED;
+        }
+    }
+
+    mags = ngx_slab_get_magazines(pool);
+
+    if (mags == NULL) {
+        return NGX_DECLINED;
+    }
+
+    mag = &mags->magazines[slot];
+
+    if (mag->number == NGX_SLAB_MAGAZINE_SIZE) {
+
+        /* drain the older half of the magazine */
+
+        ngx_slab_lock(pool);
+
+        pool->lock_stats.drains++;
+
+        for (i = 0; i < NGX_SLAB_MAGAZINE_BATCH; i++) {
+            ngx_slab_free_locked(pool, mag->chunks[i]);
+        }
+
+        ngx_shmtx_unlock(&pool->mutex);
+
+        mag->number -= NGX_SLAB_MAGAZINE_BATCH;
+
+        ngx_memmove(mag->chunks, &mag->chunks[NGX_SLAB_MAGAZINE_BATCH],
+                    mag->number * sizeof(void *));
+    }
+
+    ngx_slab_junk(p, size);
+
+    mag->chunks[mag->number++] = p;
+
+    return NGX_OK;
+}
+
+
+/*
+ * the frees are deferred until NGX_SLAB_DEFER_SIZE of them are collected,
+ * or the first of them is older than NGX_SLAB_DEFER_TIME, or the process
+ * takes the lock to allocate; so the lock is held for a bounded time,
+ * and expiry sweeps do not take it for each freed entry
+ *
+ * there is no timer, so if the process stops using the pool the frees
+ * stay deferred until the process exits; only chunks are deferred, so
+ * this is at most NGX_SLAB_DEFER_SIZE chunks of ngx_slab_max_size bytes
+ * per process, and the chunks of a killed worker are lost
+ */
+
+static ngx_int_t
+ngx_slab_defer_free(ngx_slab_pool_t *pool, void *p)
+{
+    ngx_uint_t             n;
+    ngx_slab_magazines_t  *mags;
+
+    if ((u_char *) p < pool->start || (u_char *) p >= pool->end) {
+        return NGX_DECLINED;
+    }
+
+    /* the type of the page does not change while the chunk is allocated */
+
+    n = ((u_char *) p - pool->start) >> ngx_pagesize_shift;
+
+    if (ngx_slab_page_type(&pool->pages[n]) == NGX_SLAB_PAGE) {
+        return NGX_DECLINED;
+    }
+
+    mags = ngx_slab_get_magazines(pool);
+
+    if (mags == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (mags->ndeferred == 0) {
+        mags->deferred_time = ngx_current_msec;
+    }
+
+    mags->deferred[mags->ndeferred++] = p;
+
+    if (mags->ndeferred == NGX_SLAB_DEFER_SIZE
+        || (ngx_msec_int_t) (ngx_current_msec - mags->deferred_time)
+           >= NGX_SLAB_DEFER_TIME)
+    {
+        ngx_slab_lock(pool);
+        ngx_slab_release_deferred(pool, mags);
+        ngx_shmtx_unlock(&pool->mutex);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_slab_release_deferred(ngx_slab_pool_t *pool, ngx_slab_magazines_t *mags)
+{
+    ngx_uint_t  i;
+
+    pool->lock_stats.releases++;
+
+    for (i = 0; i < mags->ndeferred; i++) {
+        ngx_slab_free_locked(pool, mags->deferred[i]);
+    }
+
+    mags->ndeferred = 0;
+}
+
+
+void
+ngx_slab_flush(ngx_slab_pool_t *pool)
+{
+    ngx_slab_magazines_t  *mags;
+
+    for (mags = ngx_slab_magazines; mags; mags = mags->next) {
+        if (mags->pool == pool) {
+            ngx_slab_flush_magazines(mags);
+            return;
+        }
+    }
+}
+
+
+static void
+ngx_slab_flush_magazines(ngx_slab_magazines_t *mags)
+{
+    ngx_uint_t            i, n;
+    ngx_slab_pool_t      *pool;
+    ngx_slab_magazine_t  *mag;
+
+    pool = mags->pool;
+
+    ngx_slab_lock(pool);
+
+    if (mags->ndeferred) {
+        ngx_slab_release_deferred(pool, mags);
+    }
+
+    for (i = 0; i < mags->nslots; i++) {
+        mag = &mags->magazines[i];
+
+        for (n = 0; n < mag->number; n++) {
+            ngx_slab_free_locked(pool, mag->chunks[n]);
+        }
+
+        mag->number = 0;
+    }
+
+    ngx_shmtx_unlock(&pool->mutex);
+}
+
+
+/* the magazines and the deferred frees are returned on worker exit */
+
+static void
+ngx_slab_exit_worker(ngx_cycle_t *cycle)
+{
+    ngx_slab_magazines_t  *mags;
+
+    for (mags = ngx_slab_magazines; mags; mags = mags->next) {
+        ngx_slab_flush_magazines(mags);
+    }
+}
+
+
+ngx_uint_t
+ngx_slab_largest_free_locked(ngx_slab_pool_t *pool)
+{
+    ngx_uint_t        bin, largest;
+    ngx_slab_page_t  *page;
+
+    /* the fragmentation of the free pages is 1 - largest / pool->pfree */
+
+    if (pool->free_map == 0) {
+        return 0;
+    }
+
+    for (bin = NGX_SLAB_FREE_BINS - 1; bin; bin--) {
+        if (pool->free_map & ((uintptr_t) 1 << bin)) {
+            break;
+        }
+    }
+
+    largest = 0;
+
+    for (page = pool->free[bin].next;
+         page != &pool->free[bin];
+         page = page->next)
+    {
+        if (page->slab > largest) {
+            largest = page->slab;
+        }
+    }
+
+    return largest;
+}
+
+
+/*
+ * the counters are copied without the lock, so they may be slightly
+ * inconsistent with each other; the largest free run needs the lock
+ * and is not calculated if the pool is busy, NGX_BUSY is returned then
+ */
+
+ngx_int_t
+ngx_slab_stat(ngx_slab_pool_t *pool, ngx_slab_zone_stat_t *st)
+{
+    size_t                 size;
+    ngx_int_t              rc;
+    ngx_uint_t             i, n;
+    ngx_slab_stat_t       *stat;
+    ngx_slab_slot_stat_t  *slot;
+
+    st->pages = pool->last - pool->pages;
+    st->pfree = pool->pfree;
+    st->lock = pool->lock_stats;
+
+    st->reqs = 0;
+    st->fails = 0;
+    st->nslots = 0;
+
+    n = ngx_slab_nslots(pool);
+
+    for (i = 0; i < n; i++) {
+        size = ngx_slab_slot_size(pool, i);
+
+        if (size == 0) {
+            continue;
+        }
+
+        stat = &pool->stats[i];
+        slot = &st->slots[st->nslots++];
+
+        slot->size = size;
+        slot->total = stat->total;
+        slot->used = stat->used;
+        slot->reqs = stat->reqs;
+        slot->fails = stat->fails;
+
+        st->reqs += slot->reqs;
+        st->fails += slot->fails;
+    }
+
+    if (ngx_shmtx_trylock(&pool->mutex)) {
+        st->largest = ngx_slab_largest_free_locked(pool);
+        ngx_shmtx_unlock(&pool->mutex);
+
+        rc = NGX_OK;
+
+    } else {
+        st->largest = 0;
+        rc = NGX_BUSY;
+    }
+
+    return rc;
+}
+
+
+void
+ngx_slab_stat_log(ngx_slab_pool_t *pool, ngx_uint_t level, ngx_log_t *log)
+{
+    ngx_int_t              rc;
+    ngx_uint_t             i, frag;
+    ngx_slab_zone_stat_t   st;
+    ngx_slab_slot_stat_t  *slot;
+
+    rc = ngx_slab_stat(pool, &st);
+
+    if (rc == NGX_OK) {
+
+        /* the fragmentation of the free pages, in permille */
+
+        frag = st.pfree ? 1000 - st.largest * 1000 / st.pfree : 0;
+
+        ngx_log_error(level, log, 0,
+                      "slab zone%s: pages:%ui free:%ui largest free:%ui "
+                      "frag:%ui.%ui%% reqs:%ui fails:%ui "
+                      "locks:%ui waits:%ui wait time:%uius",
+                      pool->log_ctx, st.pages, st.pfree, st.largest,
+                      frag / 10, frag % 10, st.reqs, st.fails,
+                      st.lock.locks, st.lock.waits, st.lock.wait_time);
+
+    } else {
+        ngx_log_error(level, log, 0,
+                      "slab zone%s: pages:%ui free:%ui largest free:busy "
+                      "reqs:%ui fails:%ui "
+                      "locks:%ui waits:%ui wait time:%uius",
+                      pool->log_ctx, st.pages, st.pfree,
+                      st.reqs, st.fails,
+                      st.lock.locks, st.lock.waits, st.lock.wait_time);
+    }
+
+    for (i = 0; i < st.nslots; i++) {
+        slot = &st.slots[i];
+
+        if (slot->reqs == 0) {
+            continue;
+        }
+
+        ngx_log_error(level, log, 0,
+                      "slab zone%s: size:%uz total:%ui used:%ui "
+                      "reqs:%ui fails:%ui",
+                      pool->log_ctx, slot->size, slot->total, slot->used,
+                      slot->reqs, slot->fails);
+    }
+}
+
+
+static size_t
+ngx_slab_slot_size(ngx_slab_pool_t *pool, ngx_uint_t slot)
+{
+    ngx_uint_t  n;
+
+    n = ngx_pagesize_shift - pool->min_shift;
+
+    if (slot < n) {
+        return (size_t) 1 << (pool->min_shift + slot);
+    }
+
+    slot -= n;
+
+    return ngx_slab_class_size[pool->min_shift + slot / NGX_SLAB_CLASSES]
+                              [slot % NGX_SLAB_CLASSES];
+}
+
+
+static ngx_inline ngx_uint_t
+ngx_slab_free_bin(ngx_uint_t pages)
+{
+    ngx_uint_t  bin;
+
+    for (bin = 0; pages >>= 1; bin++) { /* void */ }
+
+    return bin;
+}
+
+
+static void
+ngx_slab_free_link(ngx_slab_pool_t *pool, ngx_slab_page_t *page)
+{
+    ngx_uint_t        bin;
+    ngx_slab_page_t  *head;
+
+    bin = ngx_slab_free_bin(page->slab);
+    head = &pool->free[bin];
+
+    page->prev = (uintptr_t) head;
+    page->next = head->next;
+
+    page->next->prev = (uintptr_t) page;
+    head->next = page;
+
+    pool->free_map |= (uintptr_t) 1 << bin;
+}
+
+
+static void
+ngx_slab_free_unlink(ngx_slab_pool_t *pool, ngx_slab_page_t *page)
+{
+    ngx_uint_t        bin;
+    ngx_slab_page_t  *prev;
+
+    prev = ngx_slab_page_prev(page);
+    prev->next = page->next;
+    page->next->prev = page->prev;
+
+    bin = ngx_slab_free_bin(page->slab);
+
+    if (pool->free[bin].next == &pool->free[bin]) {
+        pool->free_map &= ~((uintptr_t) 1 << bin);
+    }
+}
+
+
+static ngx_slab_page_t *
+ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
+{
+    uintptr_t         map;
+    ngx_uint_t        bin;
+    ngx_slab_page_t  *page, *p;
+
+    /*
+     * a run from the bin of the requested size is searched first fit,
+     * while any run from the larger bins fits, so the smallest
+     * non-empty one is taken
+     */
+
+    bin = ngx_slab_free_bin(pages);
+
+    if (pool->free_map & ((uintptr_t) 1 << bin)) {
+
+        for (page = pool->free[bin].next;
+             page != &pool->free[bin];
+             page = page->next)
+        {
+            if (page->slab >= pages) {
+                goto found;
+            }
+        }
+    }
+
+    map = (bin + 1 < NGX_SLAB_FREE_BINS)
+          ? pool->free_map & ~(((uintptr_t) 2 << bin) - 1) : 0;
+
+    if (map) {
+        for (bin = bin + 1; !(map & ((uintptr_t) 1 << bin)); bin++) {
+            /* void */
+        }
+
+        page = pool->free[bin].next;
+
+        goto found;
+    }
+
+    if (pool->log_nomem) {
+        ngx_slab_error(pool, NGX_LOG_CRIT,
+                       "ngx_slab_alloc() failed: no memory");
+    }
+
+    return NULL;
+
+found:
+
+    ngx_slab_free_unlink(pool, page);
+
+    if (page->slab > pages) {
+        p = &page[pages];
+
+        p->slab = page->slab - pages;
+
+        if (p->slab > 1) {
+            p[p->slab - 1].prev = (uintptr_t) p;
+        }
+
+        ngx_slab_free_link(pool, p);
+    }
+
+    page->slab = pages | NGX_SLAB_PAGE_START;
+    page->next = NULL;
+    page->prev = NGX_SLAB_PAGE;
+
+    pool->pfree -= pages;
+
+    if (--pages == 0) {
+        return page;
+    }
+
+    for (p = page + 1; pages; pages--) {
+        p->slab = NGX_SLAB_PAGE_BUSY;
+        p->next = NULL;
+        p->prev = NGX_SLAB_PAGE;
+        p++;
+    }
+
+    return page;
+}
+
+
+static void
+ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
+    ngx_uint_t pages)
+{
+    ngx_slab_page_t  *join;
+
+    pool->pfree += pages;
+
+    page->slab = pages--;
+
+    if (pages) {
+        ngx_memzero(&page[1], pages * sizeof(ngx_slab_page_t));
+    }
+
+    if (page->next) {
+        /* a page of chunks in a slot list */
+
+        join = ngx_slab_page_prev(page);
+        join->next = page->next;
+        page->next->prev = page->prev;
+    }
+
+    join = page + page->slab;
+
+    if (join < pool->last) {
+
+        if (ngx_slab_page_type(join) == NGX_SLAB_PAGE) {
+
+            if (join->next != NULL) {
+                ngx_slab_free_unlink(pool, join);
+
+                pages += join->slab;
+                page->slab += join->slab;
+
+                join->slab = NGX_SLAB_PAGE_FREE;
+                join->next = NULL;
+                join->prev = NGX_SLAB_PAGE;
+            }
+        }
+    }
+
+    if (page > pool->pages) {
+        join = page - 1;
+
+        if (ngx_slab_page_type(join) == NGX_SLAB_PAGE) {
+
+            if (join->slab == NGX_SLAB_PAGE_FREE) {
+                join = ngx_slab_page_prev(join);
+            }
+
+            if (join->next != NULL) {
+                ngx_slab_free_unlink(pool, join);
+
+                pages += join->slab;
+                join->slab += page->slab;
+
+                page->slab = NGX_SLAB_PAGE_FREE;
+                page->next = NULL;
+                page->prev = NGX_SLAB_PAGE;
+
+                page = join;
+            }
+        }
+    }
+
+    if (pages) {
+        page[pages].prev = (uintptr_t) page;
+    }
 
-    pool->free.next = page;
+    ngx_slab_free_link(pool, page);
 }
 
 
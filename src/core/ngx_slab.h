@@ -13,6 +13,62 @@
 #include <ngx_core.h>
 
 
+/*
+ * the number of chunks a process may keep per slot in a magazine,
+ * and the number of chunks moved between a magazine and the pool at once
+ */
+#define NGX_SLAB_MAGAZINE_SIZE   16
+#define NGX_SLAB_MAGAZINE_BATCH  8
+
+/*
+ * the number of chunk frees a process may defer, and the time in milliseconds
+ * after which the deferred frees are released by the next free
+ */
+#define NGX_SLAB_DEFER_SIZE      64
+#define NGX_SLAB_DEFER_TIME      100
+
+/*
+ * the number of intermediate size classes between two powers of two,
+ * the classes are spaced by a quarter of the lower power of two
+ */
+#define NGX_SLAB_CLASSES         3
+
+/*
+ * the free page runs are kept in the lists by the binary logarithm
+ * of their length, the non-empty lists are marked in pool->free_map
+ */
+#define NGX_SLAB_FREE_BINS       (8 * sizeof(uintptr_t))
+
+/* the maximum number of slots, the shift of a chunk size is below 16 */
+#define NGX_SLAB_MAX_SLOTS       (16 * (NGX_SLAB_CLASSES + 1))
+
+/*
+ * a page is compacted if no more than a quarter of its chunks
+ * and no more than NGX_SLAB_COMPACT_CHUNKS chunks are used
+ */
+#define NGX_SLAB_COMPACT_CHUNKS  64
+#define NGX_SLAB_COMPACT_PAGES   32
+
+
+typedef struct ngx_slab_pool_s  ngx_slab_pool_t;
+
+/*
+ * the pressure handler is called with the pool locked when an allocation
+ * fails, it may free some memory with ngx_slab_free_locked() and return
+ * NGX_OK to retry the allocation once; a reallocation does not call it
+ */
+typedef ngx_int_t (*ngx_slab_pressure_pt)(ngx_slab_pool_t *pool, size_t size,
+    void *data);
+
+/*
+ * the relocate handler is called after a chunk is copied to a new place,
+ * it updates all references to the chunk and returns NGX_OK, otherwise
+ * the chunk stays in the old place
+ */
+typedef ngx_int_t (*ngx_slab_relocate_pt)(void *old, void *new, size_t size,
+    void *data);
+
+
 typedef struct ngx_slab_page_s  ngx_slab_page_t;
 
 struct ngx_slab_page_s {
@@ -32,6 +88,42 @@ typedef struct {
 
 
 typedef struct {
+    ngx_uint_t        locks;
+    ngx_uint_t        waits;     /* the lock was busy */
+    ngx_uint_t        wait_time; /* in microseconds */
+
+    ngx_uint_t        refills;
+    ngx_uint_t        drains;
+    ngx_uint_t        releases;  /* of the deferred frees */
+} ngx_slab_lock_stat_t;
+
+
+typedef struct {
+    size_t            size;      /* chunk size */
+    ngx_uint_t        total;
+    ngx_uint_t        used;
+
+    ngx_uint_t        reqs;
+    ngx_uint_t        fails;
+} ngx_slab_slot_stat_t;
+
+
+typedef struct {
+    ngx_uint_t            pages;
+    ngx_uint_t            pfree;
+    ngx_uint_t            largest;   /* the largest free run */
+
+    ngx_uint_t            reqs;
+    ngx_uint_t            fails;
+
+    ngx_slab_lock_stat_t  lock;
+
+    ngx_uint_t            nslots;
+    ngx_slab_slot_stat_t  slots[NGX_SLAB_MAX_SLOTS];
+} ngx_slab_zone_stat_t;
+
+
+struct ngx_slab_pool_s {
     ngx_shmtx_sh_t    lock;
 
     size_t            min_size;
@@ -39,11 +131,14 @@ typedef struct {
 
     ngx_slab_page_t  *pages;
     ngx_slab_page_t  *last;
-    ngx_slab_page_t   free;
+    ngx_slab_page_t  *free;
+    uintptr_t         free_map;
 
     ngx_slab_stat_t  *stats;
     ngx_uint_t        pfree;
 
+    ngx_slab_lock_stat_t  lock_stats;
+
     u_char           *start;
     u_char           *end;
 
@@ -53,10 +148,16 @@ typedef struct {
     u_char            zero;
 
     unsigned          log_nomem:1;
+    unsigned          magazines:1;
+    unsigned          deferred:1;
+    unsigned          size_classes:1;   /* set before ngx_slab_init() */
+
+    ngx_slab_pressure_pt  pressure;
+    void                 *pressure_data;
 
     void             *data;
     void             *addr;
-} ngx_slab_pool_t;
+};
 
 
 void ngx_slab_init(ngx_slab_pool_t *pool);
@@ -66,6 +167,17 @@ void *ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+void *ngx_slab_realloc(ngx_slab_pool_t *pool, void *p, size_t size);
+void *ngx_slab_realloc_locked(ngx_slab_pool_t *pool, void *p, size_t size);
+void ngx_slab_flush(ngx_slab_pool_t *pool);
+ngx_uint_t ngx_slab_compact(ngx_slab_pool_t *pool,
+    ngx_slab_relocate_pt relocate, void *data);
+ngx_uint_t ngx_slab_compact_locked(ngx_slab_pool_t *pool,
+    ngx_slab_relocate_pt relocate, void *data);
+ngx_uint_t ngx_slab_largest_free_locked(ngx_slab_pool_t *pool);
+ngx_int_t ngx_slab_stat(ngx_slab_pool_t *pool, ngx_slab_zone_stat_t *st);
+void ngx_slab_stat_log(ngx_slab_pool_t *pool, ngx_uint_t level,
+    ngx_log_t *log);
 
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
@@ -227,6 +227,49 @@ ngx_thread_task_alloc(ngx_pool_t *pool, size_t size)
 }
 
 
+/*
+ * the tasks with the context of the same size can be recycled
+ * through a free list instead of being allocated for each operation
+ */
+
+void
+ngx_thread_task_freelist_init(ngx_freelist_t *fl, ngx_pool_t *pool,
+    size_t size)
+{
+    ngx_freelist_init(fl, pool, sizeof(ngx_thread_task_t) + size,
+                      "thread task");
+}
+
+
+ngx_thread_task_t *
+ngx_thread_task_alloc_from(ngx_freelist_t *fl)
+{
+    ngx_thread_task_t  *task;
+
+    task = ngx_freelist_calloc(fl);
+    if (task == NULL) {
+        return NULL;
+    }
+
+    task->ctx = task + 1;
+
+    return task;
+}
+
+
+void
+ngx_thread_task_free(ngx_freelist_t *fl, ngx_thread_task_t *task)
+{
+    if (task->event.active) {
+        ngx_log_error(NGX_LOG_ALERT, fl->pool->log, 0,
+                      "task #%ui is still active", task->id);
+        return;
+    }
+
+    ngx_freelist_free(fl, task);
+}
+
+
 ngx_int_t
 ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
 {
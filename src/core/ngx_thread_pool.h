@@ -30,6 +30,10 @@ ngx_thread_pool_t *ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name);
 ngx_thread_pool_t *ngx_thread_pool_get(ngx_cycle_t *cycle, ngx_str_t *name);
 
 ngx_thread_task_t *ngx_thread_task_alloc(ngx_pool_t *pool, size_t size);
+void ngx_thread_task_freelist_init(ngx_freelist_t *fl, ngx_pool_t *pool,
+    size_t size);
+ngx_thread_task_t *ngx_thread_task_alloc_from(ngx_freelist_t *fl);
+void ngx_thread_task_free(ngx_freelist_t *fl, ngx_thread_task_t *task);
 ngx_int_t ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task);
 
 
@@ -0,0 +1,160 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * the benchmarks are linked with the core sources they test but without
+ * the cycle, process, time and log code, so the globals and functions
+ * the core sources use are defined here: the process is the single one,
+ * and the log writes to stderr
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+volatile ngx_cycle_t  *ngx_cycle;
+ngx_uint_t             ngx_process;
+ngx_pid_t              ngx_pid;
+ngx_int_t              ngx_ncpu;
+volatile ngx_msec_t    ngx_current_msec;
+
+
+static ngx_cycle_t      ngx_bench_cycle;
+static ngx_log_t        ngx_bench_log;
+static ngx_open_file_t  ngx_bench_log_file;
+
+
+static const char *ngx_bench_levels[] = {
+    "", "emerg", "alert", "crit", "error", "warn", "notice", "info", "debug"
+};
+
+
+ngx_log_t *
+ngx_log_init(u_char *prefix)
+{
+    ngx_bench_log_file.fd = ngx_stderr;
+
+    ngx_bench_log.file = &ngx_bench_log_file;
+    ngx_bench_log.log_level = NGX_LOG_NOTICE;
+
+    ngx_bench_cycle.log = &ngx_bench_log;
+    ngx_cycle = &ngx_bench_cycle;
+
+    ngx_process = NGX_PROCESS_SINGLE;
+    ngx_pid = ngx_getpid();
+
+#if (NGX_HAVE_SC_NPROCESSORS_ONLN)
+    ngx_ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    if (ngx_ncpu < 1) {
+        ngx_ncpu = 1;
+    }
+
+    ngx_time_update();
+
+    return &ngx_bench_log;
+}
+
+
+void
+ngx_time_update(void)
+{
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    ngx_current_msec = (ngx_msec_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
+#if (NGX_HAVE_VARIADIC_MACROS)
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+
+#else
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, va_list args)
+
+#endif
+{
+#if (NGX_HAVE_VARIADIC_MACROS)
+    va_list  args;
+#endif
+    u_char  *p, *last;
+    u_char   errstr[NGX_MAX_ERROR_STR];
+
+    last = errstr + NGX_MAX_ERROR_STR;
+
+    p = ngx_slprintf(errstr, last, "[%s] %P: ",
+                     ngx_bench_levels[level], ngx_pid);
+
+#if (NGX_HAVE_VARIADIC_MACROS)
+
+    va_start(args, fmt);
+    p = ngx_vslprintf(p, last, fmt, args);
+    va_end(args);
+
+#else
+
+    p = ngx_vslprintf(p, last, fmt, args);
+
+#endif
+
+    if (err) {
+        p = ngx_slprintf(p, last, " (%d: %s)", err, strerror(err));
+    }
+
+    if (p > last - NGX_LINEFEED_SIZE) {
+        p = last - NGX_LINEFEED_SIZE;
+    }
+
+    ngx_linefeed(p);
+
+    (void) ngx_write_fd(log->file->fd, errstr, p - errstr);
+}
+
+
+#if !(NGX_HAVE_VARIADIC_MACROS)
+
+void ngx_cdecl
+ngx_log_error(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+    va_list  args;
+
+    if (log->log_level >= level) {
+        va_start(args, fmt);
+        ngx_log_error_core(level, log, err, fmt, args);
+        va_end(args);
+    }
+}
+
+
+void ngx_cdecl
+ngx_log_debug_core(ngx_log_t *log, ngx_err_t err, const char *fmt, ...)
+{
+    va_list  args;
+
+    va_start(args, fmt);
+    ngx_log_error_core(NGX_LOG_DEBUG, log, err, fmt, args);
+    va_end(args);
+}
+
+#endif
+
+
+void
+ngx_debug_point(void)
+{
+    /* the benchmarks run without the debug_points directive */
+}
@@ -0,0 +1,511 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * a benchmark of the hash key functions, which is used to choose
+ * the default of ngx_hash_init_t.key, and of the wildcard lookups:
+ *
+ *     ngx_hash_bench [-n keys] [-r rounds] [-w wildcards]
+ *
+ * the quality is measured on the sets of similar keys: the sum of
+ * the lengths of the chains over the buckets of a table of the same size
+ * as the set, divided by the sum expected from a random function, so 1.0
+ * is a random function and the larger is the worse; the hash size is
+ * the one chosen by ngx_hash_init() with 256-byte buckets; the throughput
+ * is the time of a key of the given length
+ *
+ * the wildcard lookups are timed on the nested hashes built by
+ * ngx_hash_wildcard_init() from "*.w1.d1.com", ".w2.d2.org" and "w3.d3.*"
+ * like names, a third of each kind, the looked up names are random
+ * and a half of them match
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+typedef struct {
+    char                 *name;
+    ngx_hash_key_pt       key;
+} ngx_hash_bench_key_t;
+
+
+typedef struct {
+    char                 *name;
+    ngx_uint_t          (*strlow)(u_char *dst, u_char *src, size_t n);
+} ngx_hash_bench_strlow_t;
+
+
+static ngx_int_t ngx_hash_bench_options(int argc, char *const *argv);
+static void ngx_hash_bench_quality(ngx_pool_t *pool, char *fmt);
+static void ngx_hash_bench_throughput(size_t len, ngx_log_t *log);
+static void ngx_hash_bench_wildcard(ngx_pool_t *pool);
+static ngx_hash_wildcard_t *ngx_hash_bench_wildcard_init(ngx_pool_t *temp,
+    ngx_array_t *keys);
+static int ngx_libc_cdecl ngx_hash_bench_cmp_wildcards(const void *one,
+    const void *two);
+static ngx_uint_t ngx_hash_bench_random(void);
+static ngx_uint_t ngx_hash_bench_nsec(void);
+
+
+static ngx_uint_t  ngx_hash_bench_keys = 100000;
+static ngx_uint_t  ngx_hash_bench_rounds = 2000000;
+static ngx_uint_t  ngx_hash_bench_wildcards = 50000;
+
+static uint64_t    ngx_hash_bench_seed = 88172645463325252ULL;
+
+static char  *ngx_hash_bench_sets[] = {
+    "/api/v1/resource/%08ui",
+    "host%ui.example.com",
+    "x-custom-header-%ui",
+    "%ui",
+    NULL
+};
+
+static ngx_hash_bench_key_t  ngx_hash_bench_functions[] = {
+    { "ngx_hash_key", ngx_hash_key },
+    { "ngx_hash_key_fast", ngx_hash_key_fast },
+    { "ngx_hash_key_lc", ngx_hash_key_lc },
+    { "ngx_hash_key_lc_fast", ngx_hash_key_lc_fast },
+    { NULL, NULL }
+};
+
+static ngx_hash_bench_strlow_t  ngx_hash_bench_strlows[] = {
+    { "ngx_hash_strlow", ngx_hash_strlow },
+    { "ngx_hash_strlow_fast", ngx_hash_strlow_fast },
+    { NULL, NULL }
+};
+
+static size_t  ngx_hash_bench_lengths[] = { 8, 16, 24, 64, 256, 0 };
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    ngx_uint_t   i;
+    ngx_log_t   *log;
+    ngx_pool_t  *pool;
+
+    log = ngx_log_init(NULL);
+    if (log == NULL) {
+        return 1;
+    }
+
+    ngx_pagesize = getpagesize();
+
+    for (i = ngx_pagesize; i >>= 1; ngx_pagesize_shift++) { /* void */ }
+
+    ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+
+    ngx_cpuinfo();
+
+    if (ngx_hash_bench_options(argc, argv) != NGX_OK) {
+        return 1;
+    }
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, log);
+    if (pool == NULL) {
+        return 1;
+    }
+
+    printf("%-24s %-22s %8s %6s %10s\n",
+           "keys", "function", "quality", "chain", "hash size");
+
+    for (i = 0; ngx_hash_bench_sets[i]; i++) {
+        ngx_hash_bench_quality(pool, ngx_hash_bench_sets[i]);
+    }
+
+    printf("\n%-6s", "len");
+
+    for (i = 0; ngx_hash_bench_functions[i].name; i++) {
+        printf(" %22s", ngx_hash_bench_functions[i].name);
+    }
+
+    for (i = 0; ngx_hash_bench_strlows[i].name; i++) {
+        printf(" %22s", ngx_hash_bench_strlows[i].name);
+    }
+
+    printf("\n");
+
+    for (i = 0; ngx_hash_bench_lengths[i]; i++) {
+        ngx_hash_bench_throughput(ngx_hash_bench_lengths[i], log);
+    }
+
+    ngx_hash_bench_wildcard(pool);
+
+    ngx_destroy_pool(pool);
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_hash_bench_options(int argc, char *const *argv)
+{
+    u_char     *p;
+    ngx_int_t   i, n;
+
+    for (i = 1; i < argc; i++) {
+
+        p = (u_char *) argv[i];
+
+        if (*p++ != '-' || (*p != 'n' && *p != 'r' && *p != 'w')
+            || p[1] != '\0' || ++i == argc)
+        {
+            goto invalid;
+        }
+
+        n = ngx_atoi((u_char *) argv[i], ngx_strlen(argv[i]));
+
+        if (n <= 0) {
+            goto invalid;
+        }
+
+        switch (*p) {
+
+        case 'n':
+            ngx_hash_bench_keys = n;
+            break;
+
+        case 'r':
+            ngx_hash_bench_rounds = n;
+            break;
+
+        default: /* 'w' */
+            ngx_hash_bench_wildcards = n;
+        }
+    }
+
+    return NGX_OK;
+
+invalid:
+
+    fprintf(stderr,
+            "usage: ngx_hash_bench [-n keys] [-r rounds] [-w wildcards]\n");
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_hash_bench_quality(ngx_pool_t *pool, char *fmt)
+{
+    u_char                *p;
+    double                 sum, ideal;
+    ngx_uint_t             i, n, f, max, size, *chains;
+    ngx_hash_t             hash;
+    ngx_pool_t            *temp;
+    ngx_hash_key_t        *names;
+    ngx_hash_init_t        hinit;
+    ngx_hash_bench_key_t  *hk;
+
+    n = ngx_hash_bench_keys;
+
+    temp = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, pool->log);
+    if (temp == NULL) {
+        exit(1);
+    }
+
+    names = ngx_palloc(temp, n * sizeof(ngx_hash_key_t));
+    chains = ngx_palloc(temp, n * sizeof(ngx_uint_t));
+
+    if (names == NULL || chains == NULL) {
+        exit(1);
+    }
+
+    /* the numbers are spread, so the keys differ in several bytes */
+
+    for (i = 0; i < n; i++) {
+        p = ngx_pnalloc(temp, NGX_INT_T_LEN + 32);
+        if (p == NULL) {
+            exit(1);
+        }
+
+        names[i].key.data = p;
+        names[i].key.len = ngx_snprintf(p, NGX_INT_T_LEN + 32, fmt, i * 4099)
+                           - p;
+        names[i].key_hash = ngx_hash_key(p, names[i].key.len);
+        names[i].value = (void *) (i + 1);
+    }
+
+    /* the lowercase functions give the same keys for these sets */
+
+    for (f = 0; f < 2; f++) {
+        hk = &ngx_hash_bench_functions[f];
+
+        ngx_memzero(chains, n * sizeof(ngx_uint_t));
+
+        for (i = 0; i < n; i++) {
+            chains[hk->key(names[i].key.data, names[i].key.len) % n]++;
+        }
+
+        sum = 0;
+        max = 0;
+
+        for (i = 0; i < n; i++) {
+            sum += chains[i] * (chains[i] + 1) / 2.0;
+            max = ngx_max(max, chains[i]);
+        }
+
+        /* n keys of a random function over n buckets */
+
+        ideal = (3.0 * n - 1) / 2;
+
+        hinit.hash = &hash;
+        hinit.key = hk->key;
+        hinit.max_size = 100 * n;
+        hinit.bucket_size = 256;
+        hinit.name = "bench";
+        hinit.pool = temp;
+        hinit.temp_pool = NULL;
+
+        size = (ngx_hash_init(&hinit, names, n) == NGX_OK) ? hash.size : 0;
+
+        printf("%-24s %-22s %8.3f %6lu %10lu\n", fmt, hk->name, sum / ideal,
+               (unsigned long) max, (unsigned long) size);
+    }
+
+    ngx_destroy_pool(temp);
+}
+
+
+static void
+ngx_hash_bench_throughput(size_t len, ngx_log_t *log)
+{
+    u_char                   *src, *dst;
+    ngx_uint_t                i, r, start, acc;
+    ngx_hash_bench_key_t     *hk;
+    ngx_hash_bench_strlow_t  *hs;
+
+    src = ngx_alloc(2 * len, log);
+    if (src == NULL) {
+        exit(1);
+    }
+
+    dst = src + len;
+
+    for (i = 0; i < len; i++) {
+        src[i] = (u_char) ("ABCDEFGHIJKLMNOPQRSTUVWXYZ-abcdef"[i % 33]);
+    }
+
+    acc = 0;
+
+    printf("%-6lu", (unsigned long) len);
+
+    for (hk = ngx_hash_bench_functions; hk->name; hk++) {
+
+        start = ngx_hash_bench_nsec();
+
+        for (r = 0; r < ngx_hash_bench_rounds; r++) {
+            src[0] = (u_char) r;
+            acc += hk->key(src, len);
+        }
+
+        printf(" %20.1fns", (double) (ngx_hash_bench_nsec() - start)
+                            / ngx_hash_bench_rounds);
+    }
+
+    for (hs = ngx_hash_bench_strlows; hs->name; hs++) {
+
+        start = ngx_hash_bench_nsec();
+
+        for (r = 0; r < ngx_hash_bench_rounds; r++) {
+            src[0] = (u_char) r;
+            acc += hs->strlow(dst, src, len);
+        }
+
+        printf(" %20.1fns", (double) (ngx_hash_bench_nsec() - start)
+                            / ngx_hash_bench_rounds);
+    }
+
+    /* the sum keeps the calls from being optimized out */
+
+    printf("%s\n", (acc == 1) ? " " : "");
+
+    ngx_free(src);
+}
+
+
+static void
+ngx_hash_bench_wildcard(ngx_pool_t *pool)
+{
+    u_char                  *p;
+    ngx_str_t                key, *names;
+    ngx_uint_t               i, k, n, hits, start;
+    ngx_pool_t              *temp;
+    ngx_hash_wildcard_t     *head, *tail, *hwc;
+    ngx_hash_keys_arrays_t   ha;
+    void                  *(*find)(ngx_hash_wildcard_t *hwc, u_char *name,
+                                   size_t len);
+
+    n = ngx_hash_bench_wildcards;
+
+    temp = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, pool->log);
+    if (temp == NULL) {
+        exit(1);
+    }
+
+    ngx_memzero(&ha, sizeof(ngx_hash_keys_arrays_t));
+
+    ha.pool = temp;
+    ha.temp_pool = temp;
+
+    if (ngx_hash_keys_array_init(&ha, NGX_HASH_LARGE) != NGX_OK) {
+        exit(1);
+    }
+
+    /* the "w" labels are unique, so every name is added */
+
+    for (i = 0; i < n; i++) {
+        p = ngx_pnalloc(temp, 2 * NGX_INT_T_LEN + 16);
+        if (p == NULL) {
+            exit(1);
+        }
+
+        switch (i % 3) {
+
+        case 0:
+            key.len = ngx_sprintf(p, "*.w%ui.d%ui.com", i, i % 97) - p;
+            break;
+
+        case 1:
+            key.len = ngx_sprintf(p, ".w%ui.d%ui.org", i, i % 97) - p;
+            break;
+
+        default: /* 2 */
+            key.len = ngx_sprintf(p, "w%ui.d%ui.*", i, i % 97) - p;
+        }
+
+        key.data = p;
+
+        if (ngx_hash_add_key(&ha, &key, (void *) ((i + 1) << 2),
+                             NGX_HASH_WILDCARD_KEY)
+            != NGX_OK)
+        {
+            exit(1);
+        }
+    }
+
+    head = ngx_hash_bench_wildcard_init(temp, &ha.dns_wc_head);
+    tail = ngx_hash_bench_wildcard_init(temp, &ha.dns_wc_tail);
+
+    /* the names match a key of their kind with the probability of a half */
+
+    names = ngx_palloc(temp, 2 * n * sizeof(ngx_str_t));
+    if (names == NULL) {
+        exit(1);
+    }
+
+    for (i = 0; i < 2 * n; i++) {
+        p = ngx_pnalloc(temp, 2 * NGX_INT_T_LEN + 16);
+        if (p == NULL) {
+            exit(1);
+        }
+
+        k = ngx_hash_bench_random() % (2 * n);
+
+        if (i < n) {
+            k = k - k % 3 + (ngx_hash_bench_random() & 1);
+            names[i].len = ngx_sprintf(p, "www.w%ui.d%ui.%s", k, k % 97,
+                                       (k % 3) ? "org" : "com")
+                           - p;
+
+        } else {
+            k = k - k % 3 + 2;
+            names[i].len = ngx_sprintf(p, "w%ui.d%ui.net", k, k % 97) - p;
+        }
+
+        names[i].data = p;
+    }
+
+    printf("\n%-10s %-10s %12s %8s\n", "wildcards", "kind", "lookup", "hits");
+
+    for (k = 0; k < 2; k++) {
+        hwc = k ? tail : head;
+        find = k ? ngx_hash_find_wc_tail : ngx_hash_find_wc_head;
+
+        hits = 0;
+        start = ngx_hash_bench_nsec();
+
+        for (i = 0; i < ngx_hash_bench_rounds; i++) {
+            key = names[k * n + i % n];
+
+            if (find(hwc, key.data, key.len)) {
+                hits++;
+            }
+        }
+
+        printf("%-10lu %-10s %10.1fns %7.1f%%\n", (unsigned long) n,
+               k ? "tail" : "head",
+               (double) (ngx_hash_bench_nsec() - start)
+               / ngx_hash_bench_rounds,
+               100.0 * hits / ngx_hash_bench_rounds);
+    }
+
+    ngx_destroy_pool(temp);
+}
+
+
+static ngx_hash_wildcard_t *
+ngx_hash_bench_wildcard_init(ngx_pool_t *temp, ngx_array_t *keys)
+{
+    ngx_hash_init_t  hinit;
+
+    ngx_qsort(keys->elts, (size_t) keys->nelts, sizeof(ngx_hash_key_t),
+              ngx_hash_bench_cmp_wildcards);
+
+    hinit.hash = NULL;
+    hinit.key = ngx_hash_key_lc;
+    hinit.max_size = ngx_hash_bench_wildcards;
+    hinit.bucket_size = 256;
+    hinit.name = "bench_wildcards";
+    hinit.pool = temp;
+    hinit.temp_pool = temp;
+
+    if (ngx_hash_wildcard_init(&hinit, keys->elts, keys->nelts) != NGX_OK) {
+        exit(1);
+    }
+
+    return (ngx_hash_wildcard_t *) hinit.hash;
+}
+
+
+static int ngx_libc_cdecl
+ngx_hash_bench_cmp_wildcards(const void *one, const void *two)
+{
+    ngx_hash_key_t  *first, *second;
+
+    first = (ngx_hash_key_t *) one;
+    second = (ngx_hash_key_t *) two;
+
+    return ngx_dns_strcmp(first->key.data, second->key.data);
+}
+
+
+static ngx_uint_t
+ngx_hash_bench_random(void)
+{
+    /* xorshift64 */
+
+    ngx_hash_bench_seed ^= ngx_hash_bench_seed << 13;
+    ngx_hash_bench_seed ^= ngx_hash_bench_seed >> 7;
+    ngx_hash_bench_seed ^= ngx_hash_bench_seed << 17;
+
+    return (ngx_uint_t) ngx_hash_bench_seed;
+}
+
+
+static ngx_uint_t
+ngx_hash_bench_nsec(void)
+{
+    struct timespec  ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ngx_uint_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,258 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * a benchmark of the pool allocations released at once:
+ *
+ *     ngx_pool_bench [-n allocations] [-r rounds] [-s pool size]
+ *
+ * each round makes the given number of allocations of 16-256 bytes,
+ * every 64th of them is a large one of 8K, and releases them either
+ * by destroying the pool created for the round, or by rolling back
+ * a long-lived pool to the mark set before the round; the result is
+ * the time per allocation and per round, the number of blocks the round
+ * used, and whether the rolled back pool is in the state of the mark
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_POOL_BENCH_SEED  88172645463325252ULL
+
+
+static void ngx_pool_bench_destroy(ngx_uint_t n, ngx_uint_t rounds,
+    size_t size, ngx_log_t *log);
+static void ngx_pool_bench_rollback(ngx_uint_t n, ngx_uint_t rounds,
+    size_t size, ngx_log_t *log);
+static ngx_int_t ngx_pool_bench_alloc(ngx_pool_t *pool, ngx_uint_t n);
+static ngx_uint_t ngx_pool_bench_blocks(ngx_pool_t *pool);
+static ngx_uint_t ngx_pool_bench_random(void);
+static ngx_uint_t ngx_pool_bench_nsec(void);
+
+
+static uint64_t  ngx_pool_bench_seed = NGX_POOL_BENCH_SEED;
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    ngx_int_t   n, rounds, size, value, i;
+    ngx_log_t  *log;
+
+    log = ngx_log_init(NULL);
+    if (log == NULL) {
+        return 1;
+    }
+
+    ngx_pagesize = getpagesize();
+
+    for (i = ngx_pagesize; i >>= 1; ngx_pagesize_shift++) { /* void */ }
+
+    n = 1000;
+    rounds = 10000;
+    size = 4096;
+
+    for (i = 1; i < argc; i++) {
+
+        if (i + 1 < argc
+            && (ngx_strcmp(argv[i], "-n") == 0
+                || ngx_strcmp(argv[i], "-r") == 0
+                || ngx_strcmp(argv[i], "-s") == 0))
+        {
+            i++;
+            value = ngx_atoi((u_char *) argv[i], ngx_strlen(argv[i]));
+
+            switch (argv[i - 1][1]) {
+
+            case 'n':
+                n = value;
+                break;
+
+            case 'r':
+                rounds = value;
+                break;
+
+            default: /* 's' */
+                size = value;
+
+                if (size < (ngx_int_t) NGX_MIN_POOL_SIZE) {
+                    value = NGX_ERROR;
+                }
+            }
+
+            if (value > 0) {
+                continue;
+            }
+        }
+
+        fprintf(stderr, "usage: ngx_pool_bench [-n allocations] [-r rounds] "
+                        "[-s pool size]\n");
+        return 1;
+    }
+
+    printf("%-20s %10s %12s %8s %10s\n",
+           "release", "alloc", "round", "blocks", "restored");
+
+    ngx_pool_bench_destroy(n, rounds, size, log);
+    ngx_pool_bench_rollback(n, rounds, size, log);
+
+    return 0;
+}
+
+
+static void
+ngx_pool_bench_destroy(ngx_uint_t n, ngx_uint_t rounds, size_t size,
+    ngx_log_t *log)
+{
+    ngx_uint_t   i, start, nsec, blocks;
+    ngx_pool_t  *pool;
+
+    ngx_pool_bench_seed = NGX_POOL_BENCH_SEED;
+
+    blocks = 0;
+    start = ngx_pool_bench_nsec();
+
+    for (i = 0; i < rounds; i++) {
+        pool = ngx_create_pool(size, log);
+        if (pool == NULL) {
+            exit(1);
+        }
+
+        if (ngx_pool_bench_alloc(pool, n) != NGX_OK) {
+            exit(1);
+        }
+
+        blocks += ngx_pool_bench_blocks(pool);
+
+        ngx_destroy_pool(pool);
+    }
+
+    nsec = ngx_pool_bench_nsec() - start;
+
+    printf("%-20s %8.1fns %10.1fns %8.1f %10s\n", "ngx_destroy_pool()",
+           (double) nsec / (n * rounds), (double) nsec / rounds,
+           (double) blocks / rounds, "-");
+}
+
+
+static void
+ngx_pool_bench_rollback(ngx_uint_t n, ngx_uint_t rounds, size_t size,
+    ngx_log_t *log)
+{
+    size_t            psize, block_size;
+    ngx_uint_t        i, start, nsec, blocks, restored;
+    ngx_pool_t       *pool;
+    ngx_pool_mark_t   mark;
+
+    ngx_pool_bench_seed = NGX_POOL_BENCH_SEED;
+
+    pool = ngx_create_pool(size, log);
+    if (pool == NULL) {
+        exit(1);
+    }
+
+    psize = pool->size;
+    block_size = pool->block_size;
+
+    blocks = 0;
+    restored = 0;
+    start = ngx_pool_bench_nsec();
+
+    for (i = 0; i < rounds; i++) {
+        ngx_pool_mark(pool, &mark);
+
+        if (ngx_pool_bench_alloc(pool, n) != NGX_OK) {
+            exit(1);
+        }
+
+        blocks += ngx_pool_bench_blocks(pool);
+
+        ngx_pool_rollback(pool, &mark);
+
+        if (pool->size == psize
+            && pool->block_size == block_size
+            && pool->d.next == NULL)
+        {
+            restored++;
+        }
+    }
+
+    nsec = ngx_pool_bench_nsec() - start;
+
+    printf("%-20s %8.1fns %10.1fns %8.1f %9lu%%\n", "ngx_pool_rollback()",
+           (double) nsec / (n * rounds), (double) nsec / rounds,
+           (double) blocks / rounds,
+           (unsigned long) (restored * 100 / rounds));
+
+    ngx_destroy_pool(pool);
+}
+
+
+static ngx_int_t
+ngx_pool_bench_alloc(ngx_pool_t *pool, ngx_uint_t n)
+{
+    size_t      size;
+    ngx_uint_t  i;
+    u_char     *p;
+
+    for (i = 0; i < n; i++) {
+        size = (i % 64 == 63) ? 8192 : 16 + ngx_pool_bench_random() % 241;
+
+        p = ngx_palloc(pool, size);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        /* the memory is touched as a caller would */
+
+        *p = (u_char) i;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_pool_bench_blocks(ngx_pool_t *pool)
+{
+    ngx_uint_t   n;
+    ngx_pool_t  *p;
+
+    n = 0;
+
+    for (p = pool; p; p = p->d.next) {
+        n++;
+    }
+
+    return n;
+}
+
+
+static ngx_uint_t
+ngx_pool_bench_random(void)
+{
+    /* xorshift64 */
+
+    ngx_pool_bench_seed ^= ngx_pool_bench_seed << 13;
+    ngx_pool_bench_seed ^= ngx_pool_bench_seed >> 7;
+    ngx_pool_bench_seed ^= ngx_pool_bench_seed << 17;
+
+    return (ngx_uint_t) ngx_pool_bench_seed;
+}
+
+
+static ngx_uint_t
+ngx_pool_bench_nsec(void)
+{
+    struct timespec  ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ngx_uint_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
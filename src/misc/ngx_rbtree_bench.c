@@ -0,0 +1,243 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * a benchmark of the rbtree as a timer tree:
+ *
+ *     ngx_rbtree_bench [-n nodes] [-c]
+ *
+ * the nodes get random keys within a minute and are inserted with
+ * ngx_rbtree_insert_timer_value(), then the minimum is found, expired
+ * and re-armed a minute later, and at last all nodes are deleted
+ * in order, the minimum is found both by ngx_rbtree_min() from the root
+ * and by ngx_rbtree_leftmost(); -c instead checks with random inserts
+ * and deletes that the leftmost node is the minimum
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_RBTREE_BENCH_MINUTE   60000
+#define NGX_RBTREE_BENCH_SEED     88172645463325252ULL
+
+
+static void ngx_rbtree_bench_run(ngx_rbtree_node_t *nodes, ngx_uint_t n,
+    ngx_uint_t leftmost);
+static ngx_int_t ngx_rbtree_bench_check(ngx_rbtree_node_t *nodes,
+    ngx_uint_t n);
+static ngx_uint_t ngx_rbtree_bench_random(void);
+static ngx_uint_t ngx_rbtree_bench_nsec(void);
+
+
+static uint64_t  ngx_rbtree_bench_seed = NGX_RBTREE_BENCH_SEED;
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    ngx_int_t           n, i, check;
+    ngx_log_t          *log;
+    ngx_rbtree_node_t  *nodes;
+
+    log = ngx_log_init(NULL);
+    if (log == NULL) {
+        return 1;
+    }
+
+    n = 1000000;
+    check = 0;
+
+    for (i = 1; i < argc; i++) {
+
+        if (ngx_strcmp(argv[i], "-c") == 0) {
+            check = 1;
+            continue;
+        }
+
+        if (ngx_strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            i++;
+            n = ngx_atoi((u_char *) argv[i], ngx_strlen(argv[i]));
+
+            if (n > 0) {
+                continue;
+            }
+        }
+
+        fprintf(stderr, "usage: ngx_rbtree_bench [-n nodes] [-c]\n");
+        return 1;
+    }
+
+    nodes = ngx_alloc(n * sizeof(ngx_rbtree_node_t), log);
+    if (nodes == NULL) {
+        return 1;
+    }
+
+    if (check) {
+        return (ngx_rbtree_bench_check(nodes, n) == NGX_OK) ? 0 : 1;
+    }
+
+    printf("%-22s %10s %10s %14s %12s\n",
+           "min", "insert", "min", "expire+rearm", "delete min");
+
+    ngx_rbtree_bench_run(nodes, n, 0);
+    ngx_rbtree_bench_run(nodes, n, 1);
+
+    ngx_free(nodes);
+
+    return 0;
+}
+
+
+static void
+ngx_rbtree_bench_run(ngx_rbtree_node_t *nodes, ngx_uint_t n,
+    ngx_uint_t leftmost)
+{
+    ngx_uint_t          i, start, sum;
+    ngx_rbtree_t        tree;
+    ngx_rbtree_node_t   sentinel, *node;
+
+    ngx_memzero(nodes, n * sizeof(ngx_rbtree_node_t));
+
+    ngx_rbtree_init(&tree, &sentinel, ngx_rbtree_insert_timer_value);
+
+    /* both runs get the same keys */
+
+    ngx_rbtree_bench_seed = NGX_RBTREE_BENCH_SEED;
+
+    for (i = 0; i < n; i++) {
+        nodes[i].key = ngx_rbtree_bench_random() % NGX_RBTREE_BENCH_MINUTE;
+    }
+
+    printf("%-22s", leftmost ? "ngx_rbtree_leftmost()" : "ngx_rbtree_min()");
+
+    start = ngx_rbtree_bench_nsec();
+
+    for (i = 0; i < n; i++) {
+        ngx_rbtree_insert(&tree, &nodes[i]);
+    }
+
+    printf(" %8.1fns", (double) (ngx_rbtree_bench_nsec() - start) / n);
+
+    sum = 0;
+    start = ngx_rbtree_bench_nsec();
+
+    for (i = 0; i < n; i++) {
+        node = leftmost ? ngx_rbtree_leftmost(&tree)
+                        : ngx_rbtree_min(tree.root, tree.sentinel);
+
+        /* the node is read, so the lookups are not merged */
+
+        sum += node->key;
+        ngx_memory_barrier();
+    }
+
+    printf(" %8.1fns", (double) (ngx_rbtree_bench_nsec() - start) / n);
+
+    /* a timer expires and is armed again, as for a keepalive connection */
+
+    start = ngx_rbtree_bench_nsec();
+
+    for (i = 0; i < n; i++) {
+        node = leftmost ? ngx_rbtree_leftmost(&tree)
+                        : ngx_rbtree_min(tree.root, tree.sentinel);
+
+        ngx_rbtree_delete(&tree, node);
+
+        node->key += NGX_RBTREE_BENCH_MINUTE;
+        ngx_rbtree_insert(&tree, node);
+    }
+
+    printf(" %12.1fns", (double) (ngx_rbtree_bench_nsec() - start) / n);
+
+    start = ngx_rbtree_bench_nsec();
+
+    for (i = 0; i < n; i++) {
+        node = leftmost ? ngx_rbtree_leftmost(&tree)
+                        : ngx_rbtree_min(tree.root, tree.sentinel);
+
+        ngx_rbtree_delete(&tree, node);
+    }
+
+    printf(" %10.1fns%s\n", (double) (ngx_rbtree_bench_nsec() - start) / n,
+           (sum == 1) ? " " : "");
+}
+
+
+static ngx_int_t
+ngx_rbtree_bench_check(ngx_rbtree_node_t *nodes, ngx_uint_t n)
+{
+    ngx_uint_t          i, k, live;
+    ngx_rbtree_t        tree;
+    ngx_rbtree_node_t   sentinel, *node, *min;
+
+    n = ngx_min(n, 1000);
+
+    ngx_memzero(nodes, n * sizeof(ngx_rbtree_node_t));
+
+    ngx_rbtree_init(&tree, &sentinel, ngx_rbtree_insert_timer_value);
+
+    live = 0;
+
+    /* a node that is not in the tree has the NULL left link */
+
+    for (i = 0; i < 2000000; i++) {
+        k = ngx_rbtree_bench_random() % n;
+
+        if (nodes[k].left == NULL) {
+            nodes[k].key = ngx_rbtree_bench_random() % (n / 2 + 1);
+            ngx_rbtree_insert(&tree, &nodes[k]);
+            live++;
+
+        } else {
+            node = (ngx_rbtree_bench_random() & 1)
+                   ? &nodes[k] : ngx_rbtree_leftmost(&tree);
+
+            ngx_rbtree_delete(&tree, node);
+            node->left = NULL;
+            live--;
+        }
+
+        min = (tree.root == tree.sentinel)
+              ? tree.sentinel : ngx_rbtree_min(tree.root, tree.sentinel);
+
+        if (ngx_rbtree_leftmost(&tree) != min) {
+            fprintf(stderr, "leftmost node mismatch at operation %lu\n",
+                    (unsigned long) i);
+            return NGX_ERROR;
+        }
+    }
+
+    printf("check ok, %lu nodes left\n", (unsigned long) live);
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_rbtree_bench_random(void)
+{
+    /* xorshift64 */
+
+    ngx_rbtree_bench_seed ^= ngx_rbtree_bench_seed << 13;
+    ngx_rbtree_bench_seed ^= ngx_rbtree_bench_seed >> 7;
+    ngx_rbtree_bench_seed ^= ngx_rbtree_bench_seed << 17;
+
+    return (ngx_uint_t) ngx_rbtree_bench_seed;
+}
+
+
+static ngx_uint_t
+ngx_rbtree_bench_nsec(void)
+{
+    struct timespec  ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ngx_uint_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,626 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * a stress benchmark of a slab zone shared by several processes:
+ *
+ *     ngx_slab_bench [-p processes] [-n operations] [-z zone MB]
+ *                    [-d small|mixed|large|MIN-MAX] [-a alloc percent]
+ *                    [-l live chunks] [-m] [-f] [-c]
+ *
+ * each process allocates and frees chunks of the given size distribution,
+ * an allocation is done with the given probability while the process has
+ * less than the given number of live chunks, otherwise a random live chunk
+ * is freed; -m enables the magazines and -f the deferred frees;
+ * the result is the total ops/s, the p50 and p99 latencies of an operation,
+ * the lock counters and wait time, and the fragmentation of the zone
+ * after all chunks are freed but the last live set of the processes;
+ * -c instead checks with the size classes that a page of each slot
+ * is freed only with its last chunk, whichever chunk it is
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_SLAB_BENCH_HIST    (64 * 8)
+
+
+typedef struct {
+    size_t           min;
+    size_t           max;
+    ngx_uint_t       percent;  /* of the allocations from this range */
+} ngx_slab_bench_range_t;
+
+
+typedef struct {
+    ngx_uint_t       ops;
+    ngx_uint_t       allocs;
+    ngx_uint_t       frees;
+    ngx_uint_t       fails;
+    ngx_uint_t       hist[NGX_SLAB_BENCH_HIST];
+} ngx_slab_bench_result_t;
+
+
+static ngx_int_t ngx_slab_bench_options(int argc, char *const *argv);
+static ngx_int_t ngx_slab_bench_distribution(char *name);
+static void ngx_slab_bench_process(ngx_slab_pool_t *pool, ngx_uint_t n,
+    ngx_slab_bench_result_t *res, ngx_log_t *log);
+static ngx_int_t ngx_slab_bench_check(ngx_slab_pool_t *pool, ngx_log_t *log);
+static size_t ngx_slab_bench_size(void);
+static ngx_uint_t ngx_slab_bench_random(void);
+static ngx_uint_t ngx_slab_bench_nsec(void);
+static ngx_uint_t ngx_slab_bench_bucket(ngx_uint_t ns);
+static ngx_uint_t ngx_slab_bench_percentile(ngx_uint_t *hist,
+    ngx_uint_t total, ngx_uint_t permille);
+
+
+static ngx_uint_t  ngx_slab_bench_processes = 4;
+static ngx_uint_t  ngx_slab_bench_ops = 1000000;
+static size_t      ngx_slab_bench_zone = 64;
+static ngx_uint_t  ngx_slab_bench_alloc = 50;
+static ngx_uint_t  ngx_slab_bench_live = 4096;
+static ngx_uint_t  ngx_slab_bench_magazines;
+static ngx_uint_t  ngx_slab_bench_deferred;
+static ngx_uint_t  ngx_slab_bench_checks;
+static ngx_uint_t  ngx_slab_bench_seed;
+
+static ngx_slab_bench_range_t  ngx_slab_bench_ranges[3];
+static ngx_uint_t              ngx_slab_bench_nranges;
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    u_char                   *p;
+    size_t                    size;
+    ngx_uint_t                i, j, ops, allocs, frees, fails, nsec, frag;
+    ngx_log_t                *log;
+    ngx_pid_t                 pid;
+    ngx_slab_pool_t          *pool;
+    ngx_slab_zone_stat_t      st;
+    ngx_slab_bench_result_t  *res, total;
+    int                       status;
+
+    log = ngx_log_init(NULL);
+    if (log == NULL) {
+        return 1;
+    }
+
+    ngx_pagesize = getpagesize();
+
+    for (i = ngx_pagesize; i >>= 1; ngx_pagesize_shift++) { /* void */ }
+
+    ngx_pid = ngx_getpid();
+
+    if (ngx_slab_bench_distribution("mixed") != NGX_OK
+        || ngx_slab_bench_options(argc, argv) != NGX_OK)
+    {
+        return 1;
+    }
+
+    size = ngx_slab_bench_zone * 1024 * 1024;
+
+    p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
+
+    if (p == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      "mmap(MAP_ANON|MAP_SHARED, %uz) failed", size);
+        return 1;
+    }
+
+    res = mmap(NULL, ngx_slab_bench_processes
+                     * sizeof(ngx_slab_bench_result_t),
+               PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
+
+    if (res == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      "mmap(MAP_ANON|MAP_SHARED) failed");
+        return 1;
+    }
+
+    pool = (ngx_slab_pool_t *) p;
+
+    pool->end = p + size;
+    pool->min_shift = 3;
+    pool->addr = p;
+    pool->magazines = ngx_slab_bench_magazines;
+    pool->deferred = ngx_slab_bench_deferred;
+    pool->size_classes = ngx_slab_bench_checks;
+
+    if (ngx_shmtx_create(&pool->mutex, &pool->lock, NULL) != NGX_OK) {
+        return 1;
+    }
+
+    ngx_slab_init(pool);
+
+    if (ngx_slab_bench_checks) {
+        return (ngx_slab_bench_check(pool, log) == NGX_OK) ? 0 : 1;
+    }
+
+    nsec = ngx_slab_bench_nsec();
+
+    for (i = 0; i < ngx_slab_bench_processes; i++) {
+
+        pid = fork();
+
+        switch (pid) {
+
+        case -1:
+            ngx_log_error(NGX_LOG_EMERG, log, ngx_errno, "fork() failed");
+            return 1;
+
+        case 0:
+            ngx_pid = ngx_getpid();
+            ngx_slab_bench_seed = ngx_slab_bench_seed * 31 + i + 1;
+
+            ngx_slab_bench_process(pool, ngx_slab_bench_ops, &res[i], log);
+
+            exit(0);
+
+        default:
+            break;
+        }
+    }
+
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            ngx_log_error(NGX_LOG_EMERG, log, 0, "benchmark process failed");
+            return 1;
+        }
+    }
+
+    nsec = ngx_slab_bench_nsec() - nsec;
+
+    ngx_memzero(&total, sizeof(ngx_slab_bench_result_t));
+
+    for (i = 0; i < ngx_slab_bench_processes; i++) {
+        total.ops += res[i].ops;
+        total.allocs += res[i].allocs;
+        total.frees += res[i].frees;
+        total.fails += res[i].fails;
+
+        for (j = 0; j < NGX_SLAB_BENCH_HIST; j++) {
+            total.hist[j] += res[i].hist[j];
+        }
+    }
+
+    ops = total.ops;
+    allocs = total.allocs;
+    frees = total.frees;
+    fails = total.fails;
+
+    if (ngx_slab_stat(pool, &st) != NGX_OK) {
+        return 1;
+    }
+
+    /* the fragmentation of the free pages, in permille */
+
+    frag = st.pfree ? 1000 - st.largest * 1000 / st.pfree : 0;
+
+    printf("processes:%lu ops:%lu allocs:%lu frees:%lu fails:%lu\n"
+           "ops/s:%lu p50:%luns p99:%luns\n"
+           "locks:%lu waits:%lu wait time:%luus\n"
+           "pages:%lu free:%lu largest free:%lu frag:%lu.%lu%%\n",
+           (unsigned long) ngx_slab_bench_processes, (unsigned long) ops,
+           (unsigned long) allocs, (unsigned long) frees,
+           (unsigned long) fails,
+           (unsigned long) (nsec ? ops * 1000000000.0 / nsec : 0),
+           (unsigned long) ngx_slab_bench_percentile(total.hist, ops, 500),
+           (unsigned long) ngx_slab_bench_percentile(total.hist, ops, 990),
+           (unsigned long) st.lock.locks, (unsigned long) st.lock.waits,
+           (unsigned long) st.lock.wait_time,
+           (unsigned long) st.pages, (unsigned long) st.pfree,
+           (unsigned long) st.largest,
+           (unsigned long) frag / 10, (unsigned long) frag % 10);
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_slab_bench_options(int argc, char *const *argv)
+{
+    u_char     *p;
+    ngx_int_t   n;
+    ngx_int_t   i;
+
+    for (i = 1; i < argc; i++) {
+
+        p = (u_char *) argv[i];
+
+        if (*p++ != '-' || *p == '\0' || p[1] != '\0') {
+            goto invalid;
+        }
+
+        switch (*p) {
+
+        case 'm':
+            ngx_slab_bench_magazines = 1;
+            continue;
+
+        case 'f':
+            ngx_slab_bench_deferred = 1;
+            continue;
+
+        case 'c':
+            ngx_slab_bench_checks = 1;
+            continue;
+
+        case 'd':
+            if (++i == argc
+                || ngx_slab_bench_distribution(argv[i]) != NGX_OK)
+            {
+                goto invalid;
+            }
+
+            continue;
+
+        case 'p':
+        case 'n':
+        case 'z':
+        case 'a':
+        case 'l':
+            if (++i == argc) {
+                goto invalid;
+            }
+
+            n = ngx_atoi((u_char *) argv[i], ngx_strlen(argv[i]));
+
+            if (n <= 0) {
+                goto invalid;
+            }
+
+            break;
+
+        default:
+            goto invalid;
+        }
+
+        switch (*p) {
+
+        case 'p':
+            ngx_slab_bench_processes = n;
+            break;
+
+        case 'n':
+            ngx_slab_bench_ops = n;
+            break;
+
+        case 'z':
+            ngx_slab_bench_zone = n;
+            break;
+
+        case 'a':
+            if (n > 100) {
+                goto invalid;
+            }
+
+            ngx_slab_bench_alloc = n;
+            break;
+
+        default: /* 'l' */
+            ngx_slab_bench_live = n;
+            break;
+        }
+    }
+
+    return NGX_OK;
+
+invalid:
+
+    fprintf(stderr,
+            "usage: ngx_slab_bench [-p processes] [-n operations] "
+            "[-z zone MB]\n"
+            "                      [-d small|mixed|large|MIN-MAX] "
+            "[-a alloc percent]\n"
+            "                      [-l live chunks] [-m] [-f] [-c]\n");
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_slab_bench_distribution(char *name)
+{
+    u_char     *p, *last;
+    ngx_int_t   min, max;
+
+    if (ngx_strcmp(name, "small") == 0) {
+        ngx_slab_bench_ranges[0].min = 8;
+        ngx_slab_bench_ranges[0].max = 128;
+        ngx_slab_bench_ranges[0].percent = 100;
+        ngx_slab_bench_nranges = 1;
+
+        return NGX_OK;
+    }
+
+    if (ngx_strcmp(name, "mixed") == 0) {
+        ngx_slab_bench_ranges[0].min = 8;
+        ngx_slab_bench_ranges[0].max = 256;
+        ngx_slab_bench_ranges[0].percent = 80;
+        ngx_slab_bench_ranges[1].min = 257;
+        ngx_slab_bench_ranges[1].max = 2048;
+        ngx_slab_bench_ranges[1].percent = 15;
+        ngx_slab_bench_ranges[2].min = 2049;
+        ngx_slab_bench_ranges[2].max = 16384;
+        ngx_slab_bench_ranges[2].percent = 5;
+        ngx_slab_bench_nranges = 3;
+
+        return NGX_OK;
+    }
+
+    if (ngx_strcmp(name, "large") == 0) {
+        ngx_slab_bench_ranges[0].min = 4096;
+        ngx_slab_bench_ranges[0].max = 65536;
+        ngx_slab_bench_ranges[0].percent = 100;
+        ngx_slab_bench_nranges = 1;
+
+        return NGX_OK;
+    }
+
+    p = (u_char *) name;
+    last = p + ngx_strlen(name);
+
+    p = ngx_strlchr(p, last, '-');
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    min = ngx_atoi((u_char *) name, p - (u_char *) name);
+    max = ngx_atoi(p + 1, last - p - 1);
+
+    if (min <= 0 || max < min) {
+        return NGX_ERROR;
+    }
+
+    ngx_slab_bench_ranges[0].min = min;
+    ngx_slab_bench_ranges[0].max = max;
+    ngx_slab_bench_ranges[0].percent = 100;
+    ngx_slab_bench_nranges = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_slab_bench_process(ngx_slab_pool_t *pool, ngx_uint_t n,
+    ngx_slab_bench_result_t *res, ngx_log_t *log)
+{
+    void        **live;
+    ngx_uint_t    i, k, nlive, start, ns;
+
+    live = ngx_alloc(ngx_slab_bench_live * sizeof(void *), log);
+    if (live == NULL) {
+        exit(1);
+    }
+
+    nlive = 0;
+
+    for (i = 0; i < n; i++) {
+
+        if ((i & 1023) == 0) {
+            ngx_time_update();
+        }
+
+        if (nlive < ngx_slab_bench_live
+            && (nlive == 0
+                || ngx_slab_bench_random() % 100 < ngx_slab_bench_alloc))
+        {
+            k = ngx_slab_bench_size();
+
+            start = ngx_slab_bench_nsec();
+            live[nlive] = ngx_slab_alloc(pool, k);
+            ns = ngx_slab_bench_nsec() - start;
+
+            if (live[nlive] == NULL) {
+                res->fails++;
+
+            } else {
+                *(u_char *) live[nlive++] = (u_char) k;
+                res->allocs++;
+            }
+
+        } else {
+            k = ngx_slab_bench_random() % nlive;
+
+            start = ngx_slab_bench_nsec();
+            ngx_slab_free(pool, live[k]);
+            ns = ngx_slab_bench_nsec() - start;
+
+            live[k] = live[--nlive];
+            res->frees++;
+        }
+
+        res->ops++;
+        res->hist[ngx_slab_bench_bucket(ns)]++;
+    }
+
+    /* the last live set is left in the zone for the fragmentation */
+
+    ngx_slab_flush(pool);
+}
+
+
+static ngx_int_t
+ngx_slab_bench_check(ngx_slab_pool_t *pool, ngx_log_t *log)
+{
+    void                  **chunks;
+    size_t                  size;
+    ngx_uint_t              i, k, n, slot, pfree;
+    ngx_slab_zone_stat_t    st;
+
+    /* the chunks are at least 8 bytes */
+
+    chunks = ngx_alloc((ngx_pagesize / 8) * sizeof(void *), log);
+    if (chunks == NULL) {
+        return NGX_ERROR;
+    }
+
+    (void) ngx_slab_stat(pool, &st);
+
+    for (slot = 0; slot < st.nslots; slot++) {
+
+        size = st.slots[slot].size;
+
+        if (size > ngx_pagesize / 2) {
+            continue;
+        }
+
+        /* the page of the slot is allocated and freed for each chunk */
+
+        n = 1;
+
+        for (k = 0; k < n; k++) {
+            pfree = pool->pfree;
+
+            chunks[0] = ngx_slab_alloc(pool, size);
+            if (chunks[0] == NULL) {
+                return NGX_ERROR;
+            }
+
+            (void) ngx_slab_stat(pool, &st);
+
+            n = st.slots[slot].total;
+
+            for (i = 1; i < n; i++) {
+                chunks[i] = ngx_slab_alloc(pool, size);
+                if (chunks[i] == NULL) {
+                    return NGX_ERROR;
+                }
+            }
+
+            for (i = 0; i < n; i++) {
+                if (i != k) {
+                    ngx_slab_free(pool, chunks[i]);
+                }
+            }
+
+            if (pool->pfree == pfree) {
+                fprintf(stderr, "the page of %lu byte chunks is freed "
+                        "with the chunk %lu of %lu in use\n",
+                        (unsigned long) size, (unsigned long) k,
+                        (unsigned long) n);
+                return NGX_ERROR;
+            }
+
+            ngx_slab_free(pool, chunks[k]);
+
+            if (pool->pfree != pfree) {
+                fprintf(stderr, "the page of %lu byte chunks is not freed "
+                        "with the last chunk %lu of %lu\n",
+                        (unsigned long) size, (unsigned long) k,
+                        (unsigned long) n);
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    printf("check ok, %lu slots\n", (unsigned long) st.nslots);
+
+    ngx_free(chunks);
+
+    return NGX_OK;
+}
+
+
+static size_t
+ngx_slab_bench_size(void)
+{
+    ngx_uint_t               i, r;
+    ngx_slab_bench_range_t  *range;
+
+    r = ngx_slab_bench_random() % 100;
+
+    for (i = 0; i < ngx_slab_bench_nranges - 1; i++) {
+        if (r < ngx_slab_bench_ranges[i].percent) {
+            break;
+        }
+
+        r -= ngx_slab_bench_ranges[i].percent;
+    }
+
+    range = &ngx_slab_bench_ranges[i];
+
+    return range->min + ngx_slab_bench_random() % (range->max - range->min + 1);
+}
+
+
+static ngx_uint_t
+ngx_slab_bench_random(void)
+{
+    /* xorshift32 */
+
+    ngx_slab_bench_seed ^= ngx_slab_bench_seed << 13;
+    ngx_slab_bench_seed &= 0xffffffff;
+    ngx_slab_bench_seed ^= ngx_slab_bench_seed >> 17;
+    ngx_slab_bench_seed ^= ngx_slab_bench_seed << 5;
+    ngx_slab_bench_seed &= 0xffffffff;
+
+    return ngx_slab_bench_seed;
+}
+
+
+static ngx_uint_t
+ngx_slab_bench_nsec(void)
+{
+    struct timespec  ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ngx_uint_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*
+ * the latency histogram has 8 buckets per power of two: the values
+ * below 16 have a bucket each, and the bucket of a larger value is
+ * its highest bit and the next 3 bits
+ */
+
+static ngx_uint_t
+ngx_slab_bench_bucket(ngx_uint_t ns)
+{
+    ngx_uint_t  bit;
+
+    if (ns < 16) {
+        return ns;
+    }
+
+    for (bit = 1; (ns >> bit) >= 16; bit++) { /* void */ }
+
+    return ((bit + 1) << 3) + ((ns >> bit) & 7);
+}
+
+
+static ngx_uint_t
+ngx_slab_bench_percentile(ngx_uint_t *hist, ngx_uint_t total,
+    ngx_uint_t permille)
+{
+    ngx_uint_t  i, sum, bit;
+
+    sum = 0;
+
+    for (i = 0; i < NGX_SLAB_BENCH_HIST; i++) {
+        sum += hist[i];
+
+        if (sum * 1000 >= total * permille) {
+            break;
+        }
+    }
+
+    if (i < 16) {
+        return i;
+    }
+
+    /* the upper bound of the bucket */
+
+    bit = (i >> 3) - 1;
+
+    return ((8 + (i & 7) + 1) << bit) - 1;
+}
@@ -13,12 +13,110 @@ ngx_uint_t  ngx_pagesize;
 ngx_uint_t  ngx_pagesize_shift;
 ngx_uint_t  ngx_cacheline_size;
 
+ngx_uint_t        ngx_alloc_policy;
+ngx_alloc_stat_t  ngx_alloc_stat;
+
+
+#if (NGX_HAVE_MADV_HUGEPAGE && NGX_HAVE_POSIX_MEMALIGN)
+static void *ngx_alloc_huge(size_t size, ngx_log_t *log);
+#endif
+
+
+/*
+ * the policy is selected once per process, normally by a worker after it
+ * has been bound to its CPU: set_mempolicy() makes the kernel prefer the
+ * node of that CPU for all further page faults of the process, so both
+ * malloc() and posix_memalign() allocations are served node-locally
+ */
+
+ngx_int_t
+ngx_alloc_init(ngx_uint_t policy, ngx_log_t *log)
+{
+#if (NGX_HAVE_SET_MEMPOLICY)
+    unsigned       cpu, node;
+    unsigned long  mask;
+#endif
+
+    ngx_alloc_policy = NGX_ALLOC_DEFAULT;
+
+#if (NGX_HAVE_SET_MEMPOLICY)
+
+    if (policy & NGX_ALLOC_NUMA) {
+
+        if (syscall(SYS_getcpu, &cpu, &node, NULL) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno, "getcpu() failed");
+            return NGX_ERROR;
+        }
+
+        if (node >= sizeof(unsigned long) * 8) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "NUMA node %ui of CPU %ui is out of range",
+                          (ngx_uint_t) node, (ngx_uint_t) cpu);
+            return NGX_ERROR;
+        }
+
+        mask = 1UL << node;
+
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask,
+                    sizeof(unsigned long) * 8)
+            == -1)
+        {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "set_mempolicy(MPOL_PREFERRED, %ui) failed",
+                          (ngx_uint_t) node);
+            return NGX_ERROR;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, log, 0,
+                       "alloc: CPU %ui prefers NUMA node %ui",
+                       (ngx_uint_t) cpu, (ngx_uint_t) node);
+
+        ngx_alloc_policy |= NGX_ALLOC_NUMA;
+    }
+
+#else
+
+    if (policy & NGX_ALLOC_NUMA) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "NUMA allocation policy is not supported "
+                      "on this platform, ignored");
+    }
+
+#endif
+
+#if (NGX_HAVE_MADV_HUGEPAGE && NGX_HAVE_POSIX_MEMALIGN)
+
+    if (policy & NGX_ALLOC_HUGE) {
+        ngx_alloc_policy |= NGX_ALLOC_HUGE;
+    }
+
+#else
+
+    if (policy & NGX_ALLOC_HUGE) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "huge page allocation policy is not supported "
+                      "on this platform, ignored");
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
 
 void *
 ngx_alloc(size_t size, ngx_log_t *log)
 {
     void  *p;
 
+#if (NGX_HAVE_MADV_HUGEPAGE && NGX_HAVE_POSIX_MEMALIGN)
+
+    if ((ngx_alloc_policy & NGX_ALLOC_HUGE) && size >= NGX_ALLOC_HUGE_SIZE) {
+        return ngx_alloc_huge(size, log);
+    }
+
+#endif
+
     p = malloc(size);
     if (p == NULL) {
         ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
@@ -27,6 +125,15 @@ ngx_alloc(size_t size, ngx_log_t *log)
 
     ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, log, 0, "malloc: %p:%uz", p, size);
 
+    if (p) {
+        if (ngx_alloc_policy & NGX_ALLOC_NUMA) {
+            ngx_alloc_stat.numa++;
+
+        } else {
+            ngx_alloc_stat.regular++;
+        }
+    }
+
     return p;
 }
 
@@ -54,6 +161,17 @@ ngx_memalign(size_t alignment, size_t size, ngx_log_t *log)
     void  *p;
     int    err;
 
+#if (NGX_HAVE_MADV_HUGEPAGE)
+
+    if ((ngx_alloc_policy & NGX_ALLOC_HUGE)
+        && size >= NGX_ALLOC_HUGE_SIZE
+        && alignment <= NGX_ALLOC_HUGE_SIZE)
+    {
+        return ngx_alloc_huge(size, log);
+    }
+
+#endif
+
     err = posix_memalign(&p, alignment, size);
 
     if (err) {
@@ -65,6 +183,15 @@ ngx_memalign(size_t alignment, size_t size, ngx_log_t *log)
     ngx_log_debug3(NGX_LOG_DEBUG_ALLOC, log, 0,
                    "posix_memalign: %p:%uz @%uz", p, size, alignment);
 
+    if (p) {
+        if (ngx_alloc_policy & NGX_ALLOC_NUMA) {
+            ngx_alloc_stat.numa++;
+
+        } else {
+            ngx_alloc_stat.regular++;
+        }
+    }
+
     return p;
 }
 
@@ -84,6 +211,65 @@ ngx_memalign(size_t alignment, size_t size, ngx_log_t *log)
     ngx_log_debug3(NGX_LOG_DEBUG_ALLOC, log, 0,
                    "memalign: %p:%uz @%uz", p, size, alignment);
 
+    if (p) {
+        if (ngx_alloc_policy & NGX_ALLOC_NUMA) {
+            ngx_alloc_stat.numa++;
+
+        } else {
+            ngx_alloc_stat.regular++;
+        }
+    }
+
+    return p;
+}
+
+#endif
+
+
+#if (NGX_HAVE_MADV_HUGEPAGE && NGX_HAVE_POSIX_MEMALIGN)
+
+/*
+ * regions of at least NGX_ALLOC_HUGE_SIZE, such as large hash tables, are
+ * aligned at the huge page boundary and marked with MADV_HUGEPAGE, so the
+ * kernel backs them with transparent huge pages; the memory still comes
+ * from posix_memalign() and is released with ngx_free()
+ */
+
+static void *
+ngx_alloc_huge(size_t size, ngx_log_t *log)
+{
+    void  *p;
+    int    err;
+
+    err = posix_memalign(&p, NGX_ALLOC_HUGE_SIZE, size);
+
+    if (err) {
+        ngx_log_error(NGX_LOG_EMERG, log, err,
+                      "posix_memalign(%uz, %uz) failed",
+                      (size_t) NGX_ALLOC_HUGE_SIZE, size);
+        return NULL;
+    }
+
+    if (madvise(p, size & ~((size_t) NGX_ALLOC_HUGE_SIZE - 1), MADV_HUGEPAGE)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_INFO, log, ngx_errno,
+                      "madvise(%p, %uz, MADV_HUGEPAGE) failed", p, size);
+
+        if (ngx_alloc_policy & NGX_ALLOC_NUMA) {
+            ngx_alloc_stat.numa++;
+
+        } else {
+            ngx_alloc_stat.regular++;
+        }
+
+    } else {
+        ngx_alloc_stat.huge++;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, log, 0,
+                   "huge alloc: %p:%uz", p, size);
+
     return p;
 }
 
@@ -13,6 +13,22 @@
 #include <ngx_core.h>
 
 
+#define NGX_ALLOC_DEFAULT  0
+#define NGX_ALLOC_NUMA     0x01      /* prefer the node of the worker's CPU */
+#define NGX_ALLOC_HUGE     0x02      /* use huge pages for large regions */
+
+#define NGX_ALLOC_HUGE_SIZE  (2 * 1024 * 1024)
+
+
+typedef struct {
+    ngx_uint_t  regular;
+    ngx_uint_t  numa;
+    ngx_uint_t  huge;
+} ngx_alloc_stat_t;
+
+
+ngx_int_t ngx_alloc_init(ngx_uint_t policy, ngx_log_t *log);
+
 void *ngx_alloc(size_t size, ngx_log_t *log);
 void *ngx_calloc(size_t size, ngx_log_t *log);
 
@@ -41,5 +57,8 @@ extern ngx_uint_t  ngx_pagesize;
 extern ngx_uint_t  ngx_pagesize_shift;
 extern ngx_uint_t  ngx_cacheline_size;
 
+extern ngx_uint_t        ngx_alloc_policy;
+extern ngx_alloc_stat_t  ngx_alloc_stat;
+
 
 #endif /* _NGX_ALLOC_H_INCLUDED_ */